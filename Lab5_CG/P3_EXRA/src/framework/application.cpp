@@ -4,6 +4,7 @@
 #include "mesh.h"
 #include "light.h"
 #include "material.h"
+#include <algorithm>
 
 Light* light = new Light();
 Material* material = new Material();
@@ -24,7 +25,9 @@ Application::Application(const char* caption, int width, int height)
 
 	zbuffer.resize(w, h);
 	zbuffer.fill(100000);
+	gbuffer.resize(w, h);
 	framebuffer.resize(w, h);
+	memset(&cull_stats, 0, sizeof(cull_stats));
 }
 
 //Here we have already GL working, so we can create meshes and textures
@@ -51,6 +54,14 @@ void Application::init(void)
 	texture_normal = new Image();
 	texture_normal->loadTGA("lee_normal.tga");
 
+	//workers used by the renderer, one thread per core
+	pool = new ThreadPool();
+	std::cout << "rendering with " << pool->size() << " threads" << std::endl;
+
+	//shade 8 pixels at a time when the CPU supports it
+	Image::simd_shading = SDL_HasAVX2() == SDL_TRUE;
+	std::cout << "AVX2 shading: " << (Image::simd_shading ? "yes" : "no") << std::endl;
+
 }
 
 //this function fills the triangle by computing the bounding box of the triangle in screen space and using the barycentric interpolation
@@ -79,56 +90,442 @@ void Application::init(void)
 //render one frame
 void Application::render(Image& framebuffer)
 {
-	framebuffer.fill(Color(40, 45, 60)); //clear
-	zbuffer.fill(100000);
-	//for every point of the mesh (to draw triangles take three points each time and connect the points between them (1,2,3,   4,5,6,   ...)
-	for (int i = 0; i < mesh->vertices.size()-3; i+=3)
+	//geometry stage: project every triangle of the mesh and sort them into screen bins (in parallel)
+	//the wireframe shows every edge of the mesh, the culled triangles too
+	projectAndBinTriangles(framebuffer, mode == 1 ? 0 : cull_mode);
+
+	if (mode == 1) {
+		//lines are not clipped to the bins, so the wireframe is drawn from this thread only
+		framebuffer.fill(Color(40, 45, 60)); //clear
+		for (size_t i = 0; i < screen_triangles.size(); i++) {
+			const ScreenTriangle& t = screen_triangles[i];
+			if (t.id >= 0)
+				framebuffer.drawTriangle(t.x[0], t.y[0], t.x[1], t.y[1], t.x[2], t.y[2], Color::WHITE, false);
+		}
+		for (size_t chunk = 0; chunk < clipped_triangles.size(); chunk++)
+			for (size_t i = 0; i < clipped_triangles[chunk].size(); i++) {
+				const ScreenTriangle& t = clipped_triangles[chunk][i];
+				framebuffer.drawTriangle(t.x[0], t.y[0], t.x[1], t.y[1], t.x[2], t.y[2], Color::WHITE, false);
+			}
+		return;
+	}
+
+	//raster stage: every bin owns its own pixels of the framebuffer and the zbuffer, so they can be filled in parallel without locks
+	pool->parallelFor(bins_x * bins_y, [&](int bin, int /*thread*/) {
+		rasterizeBin(framebuffer, bin);
+	});
+}
+
+//vertex of a triangle being clipped, in clip space (before the division by w)
+typedef struct sClipVertex {
+	Vector4 position;
+	Vector2 uv;
+} ClipVertex;
+
+#define CLIP_MAX_VERTICES 9 //every plane can add one vertex to the triangle
+
+//distance of a point in clip space to a clipping plane, negative outside: 0 near, 1 far, 2 to 5 the left, right, bottom and top edges of the screen
+static float clipDistance(const Vector4& p, int plane)
+{
+	switch (plane) {
+		case 0: return p.z + p.w;
+		case 1: return p.w - p.z;
+		case 2: return p.x + p.w;
+		case 3: return p.w - p.x;
+		case 4: return p.y + p.w;
+		default: return p.w - p.y;
+	}
+}
+
+//true if the triangle is discarded by the cull flags, counting why in the stats
+static bool cullTriangle(const Application::ScreenTriangle& t, int cull, CullStats& stats)
+{
+	//positive for counter-clockwise triangles, the front faces (y goes up in the framebuffer)
+	long long area = (long long)(t.x[1] - t.x[0]) * (t.y[2] - t.y[0]) - (long long)(t.y[1] - t.y[0]) * (t.x[2] - t.x[0]);
+	if (((cull & CULL_BACK) && area < 0) || ((cull & CULL_FRONT) && area > 0))
 	{
-		Vector3 vertex_1 = (mesh->vertices[i]); //extract vertex from mesh
-		Vector3 vertex_2 = (mesh->vertices[i+1]);
-		Vector3 vertex_3 = (mesh->vertices[i + 2]);
+		stats.faces++;
+		return true;
+	}
+	if (cull & CULL_DEGENERATE)
+	{
+		if (area == 0)
+		{
+			stats.zero_area++;
+			return true;
+		}
+		if (!Image::coversPixel(t.x[0], t.y[0], t.x[1], t.y[1], t.x[2], t.y[2]))
+		{
+			stats.subpixel++;
+			return true;
+		}
+	}
+	return false;
+}
 
-		Vector2 texcoord_1 = mesh->uvs[i]; //texture coordinate of the vertex (they are normalized, from 0,0 to 1,1)
-		Vector2 texcoord_2 = mesh->uvs[i+1];
-		Vector2 texcoord_3 = mesh->uvs[i+2];
+//Sutherland-Hodgman: keeps the part of the polygon inside the plane and returns its number of vertices
+static int clipPolygon(const ClipVertex* polygon, int count, ClipVertex* result, int plane)
+{
+	int result_count = 0;
+	for (int i = 0; i < count; i++)
+	{
+		const ClipVertex& a = polygon[i];
+		const ClipVertex& b = polygon[(i + 1) % count];
+		float da = clipDistance(a.position, plane);
+		float db = clipDistance(b.position, plane);
+		if (da >= 0.0f)
+			result[result_count++] = a;
+		if ((da >= 0.0f) != (db >= 0.0f))
+		{
+			//the edge crosses the plane, the uvs interpolate linearly here because w was not divided yet
+			float f = da / (da - db);
+			ClipVertex& v = result[result_count++];
+			v.position.set(a.position.x + (b.position.x - a.position.x) * f, a.position.y + (b.position.y - a.position.y) * f,
+				a.position.z + (b.position.z - a.position.z) * f, a.position.w + (b.position.w - a.position.w) * f);
+			v.uv = a.uv + (b.uv - a.uv) * f;
+		}
+	}
+	return result_count;
+}
 
+//true if the box is completely outside the frustum of the viewprojection matrix: its 8 corners are (in clip space) outside the same plane
+static bool isBoxOutsideFrustum(const Matrix44& viewprojection, const Vector3& box_min, const Vector3& box_max)
+{
+	int outside_all = 63;
+	for (int i = 0; i < 8; i++)
+	{
+		Vector4 p = viewprojection * Vector4((i & 1) ? box_max.x : box_min.x, (i & 2) ? box_max.y : box_min.y, (i & 4) ? box_max.z : box_min.z, 1.0f);
+		int outside = 0;
+		if (p.x < -p.w) outside |= 1;
+		if (p.x > p.w) outside |= 2;
+		if (p.y < -p.w) outside |= 4;
+		if (p.y > p.w) outside |= 8;
+		if (p.z < -p.w) outside |= 16;
+		if (p.z > p.w) outside |= 32;
+		outside_all &= outside;
+	}
+	return outside_all != 0;
+}
 
-		Vector3 norm1 = camera->projectVector(vertex_1);
-		Vector3 norm2 = camera->projectVector(vertex_2);
-		Vector3 norm3 = camera->projectVector(vertex_3);
-		
-		Vector2 tex1 = Vector2(texcoord_1.x, texcoord_1.y);
-		Vector2 tex2 = Vector2(texcoord_2.x, texcoord_2.y);
-		Vector2 tex3 = Vector2(texcoord_3.x, texcoord_3.y);
+//projects the vertices of the mesh to framebuffer coordinates, builds the triangles, discards the ones in cull (CULL_* flags) and adds
+//the rest to the bins their bounding box touches.
+//Every job handles a chunk of GEOMETRY_CHUNK_SIZE vertices or triangles and has its own bin lists, so no locking is needed
+void Application::projectAndBinTriangles(Image& framebuffer, int cull)
+{
+	bool indexed = mesh->indices.size() > 0;
+	int num_vertices = mesh->vertices.size();
+	int num_triangles = (indexed ? mesh->indices.size() : mesh->vertices.size()) / 3;
+	int num_chunks = (num_triangles + GEOMETRY_CHUNK_SIZE - 1) / GEOMETRY_CHUNK_SIZE;
 
-		//project every point in the mesh to normalized coordinates using the viewprojection_matrix inside camera
-		//Vector3 normalized_point = camera->projectVector( vertex );
+	bins_x = (framebuffer.width + RASTER_BIN_SIZE - 1) / RASTER_BIN_SIZE;
+	bins_y = (framebuffer.height + RASTER_BIN_SIZE - 1) / RASTER_BIN_SIZE;
+	int num_bins = bins_x * bins_y;
 
-		//convert from normalized (-1 to +1) to framebuffer coordinates (0,W)
-		Vector3 res1 = Vector3(framebuffer.width / 2 * norm1.x + framebuffer.width / 2, framebuffer.height / 2 * norm1.y + framebuffer.height / 2, norm1.z);
-		Vector3 res2 = Vector3(framebuffer.width / 2 * norm2.x + framebuffer.width / 2, framebuffer.height / 2 * norm2.y + framebuffer.height / 2, norm2.z);
-		Vector3 res3 = Vector3(framebuffer.width / 2 * norm3.x + framebuffer.width / 2,  framebuffer.height / 2 * norm3.y + framebuffer.height / 2, norm3.z );
+	if (!mesh->hasStreams())
+		mesh->updateStreams(); //Matrix44::projectPoints reads the positions as structure of arrays (and the bounds are refreshed with them)
 
-		
-		
-		
-		//paint points in framebuffer (using your drawTriangle function or the fillTriangle function)
-		//framebuffer.drawTriangleInterpolated(res1.x, res1.y, res2.x, res2.y, res3.x, res3.y, Color::RED, Color::BLUE, Color::GREEN);
+	//the whole mesh first: if its box is outside the camera there is nothing to project
+	if (isBoxOutsideFrustum(camera->viewprojection_matrix, mesh->aabb_min, mesh->aabb_max))
+	{
+		screen_triangles.clear();
+		clipped_triangles.clear();
+		bins.clear();
+		bins.resize(num_bins);
+		memset(&cull_stats, 0, sizeof(cull_stats));
+		cull_stats.triangles = cull_stats.outside = num_triangles;
+		return;
+	}
 
-		if (mode == 1) {
-			framebuffer.drawTriangle(res1.x, res1.y, res2.x, res2.y, res3.x, res3.y, Color::WHITE, false);
+	screen_vertices.resize(num_vertices);
+	screen_triangles.resize(num_triangles);
+	clipped_triangles.resize(num_chunks);
+	bins.resize(num_chunks * num_bins);
+	std::vector<CullStats> chunk_stats(num_chunks);
+
+	//vertices
+	pool->parallelFor((num_vertices + GEOMETRY_CHUNK_SIZE - 1) / GEOMETRY_CHUNK_SIZE, [&](int chunk, int /*thread*/) {
+		int start = chunk * GEOMETRY_CHUNK_SIZE;
+		int end = std::min(start + GEOMETRY_CHUNK_SIZE, num_vertices);
+
+		//project the whole chunk to framebuffer coordinates (0,W) with the viewprojection_matrix inside camera
+		float screen_x[GEOMETRY_CHUNK_SIZE], screen_y[GEOMETRY_CHUNK_SIZE], screen_z[GEOMETRY_CHUNK_SIZE], clip_w[GEOMETRY_CHUNK_SIZE];
+		camera->viewprojection_matrix.projectPoints(&mesh->position_stream[0][start], &mesh->position_stream[1][start], &mesh->position_stream[2][start], end - start,
+			(float)framebuffer.width, (float)framebuffer.height, screen_x, screen_y, screen_z, clip_w);
+
+		for (int i = start; i < end; i++)
+		{
+			ScreenVertex& v = screen_vertices[i];
+			float x = screen_x[i - start];
+			float y = screen_y[i - start];
+			v.z = screen_z[i - start];
+
+			//the comparisons are written so a NaN (w = 0) also counts as outside
+			v.clip = 0;
+			if (!(clip_w[i - start] > 0.0f) || !(v.z >= -1.0f))
+				v.clip = CLIP_NEAR;
+			else
+			{
+				if (v.z > 1.0f)
+					v.clip |= CLIP_FAR;
+				if (!(x >= -CLIP_GUARD_BAND && x <= framebuffer.width + CLIP_GUARD_BAND && y >= -CLIP_GUARD_BAND && y <= framebuffer.height + CLIP_GUARD_BAND))
+					v.clip |= CLIP_GUARD;
+			}
+
+			if (v.clip & (CLIP_NEAR | CLIP_GUARD))
+				v.x = v.y = 0; //not used, its triangles are clipped
+			else
+			{
+				v.x = (int)x;
+				v.y = (int)y;
+			}
+		}
+	});
+
+	//triangles
+	pool->parallelFor(num_chunks, [&](int chunk, int /*thread*/) {
+		std::vector<int>* chunk_bins = &bins[chunk * num_bins];
+		for (int b = 0; b < num_bins; b++)
+			chunk_bins[b].clear();
+		std::vector<ScreenTriangle>& pieces = clipped_triangles[chunk];
+		pieces.clear();
+		CullStats& stats = chunk_stats[chunk];
+
+		int start = chunk * GEOMETRY_CHUNK_SIZE;
+		int end = std::min(start + GEOMETRY_CHUNK_SIZE, num_triangles);
+		for (int i = start; i < end; i++)
+		{
+			ScreenTriangle& t = screen_triangles[i];
+			int clip_any = 0;
+			int clip_all = CLIP_NEAR | CLIP_FAR;
+			for (int k = 0; k < 3; k++)
+			{
+				int index = indexed ? mesh->indices[i * 3 + k] : i * 3 + k;
+				const ScreenVertex& v = screen_vertices[index];
+				t.x[k] = v.x;
+				t.y[k] = v.y;
+				t.z[k] = v.z;
+				t.uv[k] = mesh->uvs[index]; //texture coordinate of the vertex (they are normalized, from 0,0 to 1,1)
+				clip_any |= v.clip;
+				clip_all &= v.clip;
+			}
+			t.id = i;
+
+			if (clip_all)
+			{
+				t.id = -1; //all of it behind the near plane or past the far one
+				stats.outside++;
+				continue;
+			}
+			if (clip_any)
+			{
+				t.id = -1;
+				stats.clipped++;
+				size_t first = pieces.size();
+				clipTriangle(framebuffer, i, cull, pieces, stats);
+				for (size_t n = first; n < pieces.size(); n++)
+					stats.binned += binTriangle(framebuffer, pieces[n], -(int)n - 1, chunk_bins);
+				continue;
+			}
+			if (cullTriangle(t, cull, stats))
+			{
+				t.id = -1;
+				continue;
+			}
+			stats.binned += binTriangle(framebuffer, t, i, chunk_bins);
 		}
-		if (mode == 2) {
-			framebuffer.drawTriangleInterpolated_color(res1.x, res1.y, res2.x, res2.y, res3.x, res3.y, res1.z, res2.z, res2.z, &zbuffer, Color::RED, Color::BLUE, Color::GREEN);
+	});
+
+	memset(&cull_stats, 0, sizeof(cull_stats));
+	cull_stats.triangles = num_triangles;
+	for (int chunk = 0; chunk < num_chunks; chunk++)
+	{
+		const CullStats& stats = chunk_stats[chunk];
+		cull_stats.outside += stats.outside;
+		cull_stats.clipped += stats.clipped;
+		cull_stats.faces += stats.faces;
+		cull_stats.zero_area += stats.zero_area;
+		cull_stats.subpixel += stats.subpixel;
+		cull_stats.binned += stats.binned;
+	}
+}
+
+//clips a triangle that crosses the near or far planes or goes past the guard band. It is done in clip space, where the uvs still
+//interpolate linearly, and the pieces not culled are added to the list already in framebuffer coordinates
+void Application::clipTriangle(Image& framebuffer, int triangle, int cull, std::vector<ScreenTriangle>& pieces, CullStats& stats)
+{
+	bool indexed = mesh->indices.size() > 0;
+	ClipVertex polygon[CLIP_MAX_VERTICES], clipped[CLIP_MAX_VERTICES];
+	int count = 3;
+	for (int k = 0; k < 3; k++)
+	{
+		int index = indexed ? mesh->indices[triangle * 3 + k] : triangle * 3 + k;
+		const Vector3& p = mesh->vertices[index];
+		polygon[k].position = camera->viewprojection_matrix * Vector4(p.x, p.y, p.z, 1.0f);
+		polygon[k].uv = mesh->uvs[index];
+	}
+
+	for (int plane = 0; plane < 2 && count > 0; plane++)
+	{
+		count = clipPolygon(polygon, count, clipped, plane);
+		memcpy(polygon, clipped, count * sizeof(ClipVertex));
+	}
+
+	//the edges of the screen only if something still goes past the guard band (in clip space it is |x| <= guard_x * w)
+	float guard_x = 1.0f + 2.0f * CLIP_GUARD_BAND / framebuffer.width;
+	float guard_y = 1.0f + 2.0f * CLIP_GUARD_BAND / framebuffer.height;
+	bool inside_guard_band = true;
+	for (int k = 0; k < count; k++)
+	{
+		const Vector4& p = polygon[k].position;
+		if (!(fabs(p.x) <= guard_x * p.w && fabs(p.y) <= guard_y * p.w))
+			inside_guard_band = false;
+	}
+	if (!inside_guard_band)
+		for (int plane = 2; plane < 6 && count > 0; plane++)
+		{
+			count = clipPolygon(polygon, count, clipped, plane);
+			memcpy(polygon, clipped, count * sizeof(ClipVertex));
 		}
-		if (mode == 3) {
-			framebuffer.drawTriangleInterpolated(res1.x, res1.y, res2.x, res2.y, res3.x, res3.y, res1.z, res2.z, res3.z, &zbuffer, tex1, tex2, tex3, texture);
+	if (count < 3)
+		return; //nothing left
+
+	//to framebuffer coordinates as in Matrix44::projectPoints, and a fan of triangles from the first vertex
+	float half_width = framebuffer.width * 0.5f;
+	float half_height = framebuffer.height * 0.5f;
+	int x[CLIP_MAX_VERTICES], y[CLIP_MAX_VERTICES];
+	float z[CLIP_MAX_VERTICES];
+	for (int k = 0; k < count; k++)
+	{
+		const Vector4& p = polygon[k].position;
+		x[k] = (int)(half_width * (p.x / p.w) + half_width);
+		y[k] = (int)(half_height * (p.y / p.w) + half_height);
+		z[k] = p.z / p.w;
+	}
+	for (int k = 2; k < count; k++)
+	{
+		int corners[3] = { 0, k - 1, k };
+		ScreenTriangle t;
+		for (int c = 0; c < 3; c++)
+		{
+			t.x[c] = x[corners[c]];
+			t.y[c] = y[corners[c]];
+			t.z[c] = z[corners[c]];
+			t.uv[c] = polygon[corners[c]].uv;
 		}
-		if (mode == 4) {
-			framebuffer.PhongIlluminationTexture(res1.x, res1.y, res2.x, res2.y, res3.x, res3.y, res1.z, res2.z, res3.z, &zbuffer, material, light, camera->eye, tex1, tex2, tex3, texture, texture_normal);
+		t.id = triangle;
+		if (!cullTriangle(t, cull, stats))
+			pieces.push_back(t);
+	}
+}
+
+//adds the triangle to the bins of the chunk that its bounding box touches, false if it is outside the framebuffer
+bool Application::binTriangle(Image& framebuffer, const ScreenTriangle& t, int index, std::vector<int>* chunk_bins)
+{
+	int minx = std::min(t.x[0], std::min(t.x[1], t.x[2]));
+	int miny = std::min(t.y[0], std::min(t.y[1], t.y[2]));
+	int maxx = std::max(t.x[0], std::max(t.x[1], t.x[2]));
+	int maxy = std::max(t.y[0], std::max(t.y[1], t.y[2]));
+	if (maxx < 0 || maxy < 0 || minx >= (int)framebuffer.width || miny >= (int)framebuffer.height)
+		return false; //outside the framebuffer
+
+	int bin_minx = std::max(minx, 0) / RASTER_BIN_SIZE;
+	int bin_miny = std::max(miny, 0) / RASTER_BIN_SIZE;
+	int bin_maxx = std::min(maxx, (int)framebuffer.width - 1) / RASTER_BIN_SIZE;
+	int bin_maxy = std::min(maxy, (int)framebuffer.height - 1) / RASTER_BIN_SIZE;
+	for (int by = bin_miny; by <= bin_maxy; by++)
+		for (int bx = bin_minx; bx <= bin_maxx; bx++)
+			chunk_bins[by * bins_x + bx].push_back(index);
+	return true;
+}
+
+//clears the pixels of one bin and draws all the triangles that touch it, clipped to the bin
+void Application::rasterizeBin(Image& framebuffer, int bin)
+{
+	int num_bins = bins_x * bins_y;
+	int num_chunks = bins.size() / num_bins;
+
+	ScreenRect rect;
+	rect.minx = (bin % bins_x) * RASTER_BIN_SIZE;
+	rect.miny = (bin / bins_x) * RASTER_BIN_SIZE;
+	rect.maxx = std::min(rect.minx + RASTER_BIN_SIZE, (int)framebuffer.width) - 1;
+	rect.maxy = std::min(rect.miny + RASTER_BIN_SIZE, (int)framebuffer.height) - 1;
+
+	//clear
+	for (int y = rect.miny; y <= rect.maxy; y++)
+		for (int x = rect.minx; x <= rect.maxx; x++)
+			framebuffer.setPixel(x, y, Color(40, 45, 60));
+	zbuffer.fillRect(rect, 100000);
+	if (mode == 5)
+		gbuffer.clearRect(rect);
+
+	//chunks are visited in order so the triangles are drawn in the same order as they are in the mesh
+	for (int chunk = 0; chunk < num_chunks; chunk++)
+	{
+		const std::vector<int>& list = bins[chunk * num_bins + bin];
+		for (size_t i = 0; i < list.size(); i++)
+		{
+			const ScreenTriangle& t = list[i] >= 0 ? screen_triangles[list[i]] : clipped_triangles[chunk][-list[i] - 1];
+
+			if (mode == 2) {
+				framebuffer.drawTriangleInterpolated_color(t.x[0], t.y[0], t.x[1], t.y[1], t.x[2], t.y[2], t.z[0], t.z[1], t.z[2], &zbuffer, Color::RED, Color::BLUE, Color::GREEN, &rect);
+			}
+			if (mode == 3) {
+				framebuffer.drawTriangleInterpolated(t.x[0], t.y[0], t.x[1], t.y[1], t.x[2], t.y[2], t.z[0], t.z[1], t.z[2], &zbuffer, t.uv[0], t.uv[1], t.uv[2], texture, &rect);
+			}
+			if (mode == 4) {
+				framebuffer.PhongIlluminationTexture(t.x[0], t.y[0], t.x[1], t.y[1], t.x[2], t.y[2], t.z[0], t.z[1], t.z[2], &zbuffer, material, light, camera->eye, t.uv[0], t.uv[1], t.uv[2], texture, texture_normal, &rect);
+			}
+			if (mode == 5) {
+				framebuffer.drawTriangleGBuffer(t.x[0], t.y[0], t.x[1], t.y[1], t.x[2], t.y[2], t.z[0], t.z[1], t.z[2], &zbuffer, t.uv[0], t.uv[1], t.uv[2], &gbuffer, t.id, &rect);
+			}
 		}
-		//framebuffer.drawTriangleInterpolated(res1.x, res1.y, res2.x, res2.y, res3.x, res3.y, res1.z, res2.z, res3.z, &zbuffer, tex1, tex2, tex3, texture);
 	}
+
+	//deferred: now that the visible triangle of every pixel is known, light each one only once
+	if (mode == 5)
+		framebuffer.PhongIlluminationGBuffer(&zbuffer, &gbuffer, material, light, camera->eye, texture, texture_normal, rect);
+}
+
+//renders the current frame (in mode 4 if the current one has no shading) with the scalar and the AVX2 shading and reports the
+//largest difference between them. True if it is within SIMD_SHADING_TOLERANCE, the framebuffer keeps the AVX2 frame
+bool Application::checkSimdShading()
+{
+	if (SDL_HasAVX2() != SDL_TRUE)
+	{
+		std::cout << "AVX2 shading check: this CPU has no AVX2, there is only the scalar shading" << std::endl;
+		return true;
+	}
+
+	bool simd = Image::simd_shading;
+	int current_mode = mode;
+	if (mode != 4 && mode != 5)
+		mode = 4;
+
+	Image::simd_shading = false;
+	render(framebuffer);
+	Image scalar = framebuffer;
+	Image::simd_shading = true;
+	render(framebuffer);
+
+	Image::simd_shading = simd;
+	mode = current_mode;
+
+	int max_difference = 0;
+	int num_different = 0;
+	for (unsigned int i = 0; i < framebuffer.width * framebuffer.height; i++)
+	{
+		const Color& a = scalar.pixels[i];
+		const Color& b = framebuffer.pixels[i];
+		int difference = std::max(abs(a.r - b.r), std::max(abs(a.g - b.g), abs(a.b - b.b)));
+		if (difference)
+			num_different++;
+		max_difference = std::max(max_difference, difference);
+	}
+
+	bool ok = max_difference <= SIMD_SHADING_TOLERANCE;
+	std::cout << "AVX2 shading check: " << num_different << " pixels differ from the scalar shading, by " << max_difference << " at most (tolerance "
+		<< SIMD_SHADING_TOLERANCE << "): " << (ok ? "ok" : "FAILED") << std::endl;
+	return ok;
 }
 
 //called after render
@@ -190,6 +587,20 @@ void Application::onKeyDown( SDL_KeyboardEvent event )
 		case SDL_SCANCODE_2: mode = 2; break;
 		case SDL_SCANCODE_3: mode = 3; break;
 		case SDL_SCANCODE_4: mode = 4; break;
+		case SDL_SCANCODE_5: mode = 5; break; //same as 4 but deferred: raster to the G-buffer, then light the visible pixels
+		case SDL_SCANCODE_V: //switch between the AVX2 and the scalar shading to compare them
+			Image::simd_shading = !Image::simd_shading && SDL_HasAVX2() == SDL_TRUE;
+			std::cout << "AVX2 shading: " << (Image::simd_shading ? "yes" : "no") << std::endl;
+			break;
+		case SDL_SCANCODE_T: checkSimdShading(); break;
+		case SDL_SCANCODE_C:
+			cull_mode ^= CULL_BACK;
+			std::cout << "Back face culling: " << ((cull_mode & CULL_BACK) ? "yes" : "no") << std::endl;
+			break;
+		case SDL_SCANCODE_I:
+			std::cout << "Triangles: " << cull_stats.triangles << ", " << cull_stats.outside << " outside the near/far planes, " << cull_stats.clipped << " clipped, "
+				<< cull_stats.faces << " faces, " << cull_stats.zero_area << " zero area and " << cull_stats.subpixel << " subpixel culled, " << cull_stats.binned << " rasterized" << std::endl;
+			break;
 		
 	}
 }
@@ -12,6 +12,37 @@
 #include "image.h"
 #include "light.h"
 #include "material.h"
+#include "threadpool.h"
+
+//side in pixels of the square screen bins the triangles are sorted into before rasterizing (multiple of RASTER_TILE_SIZE, so no depth tile is shared by two bins)
+#define RASTER_BIN_SIZE 64
+//triangles projected and binned by every job of the geometry stage
+#define GEOMETRY_CHUNK_SIZE 1024
+//pixels the guard band reaches beyond every edge of the framebuffer: triangles inside it are rasterized as they are (the raster stage
+//already limits them to the bins they touch) and only the ones going past it are clipped against the edges of the screen
+#define CLIP_GUARD_BAND 4096
+
+//clip codes of the screen vertices, the planes they are outside of
+#define CLIP_NEAR 1 //behind the near plane (or the camera), its screen coordinates are not valid
+#define CLIP_FAR 2
+#define CLIP_GUARD 4 //outside the guard band, its screen coordinates would not fit in the rasterizer
+
+//what the geometry stage discards before binning (Application::cull_mode)
+#define CULL_BACK 1 //facing away from the camera, clockwise on the screen
+#define CULL_FRONT 2
+#define CULL_DEGENERATE 4 //zero area, or too small to cover any pixel center
+
+//what the geometry stage did with the triangles of the last frame (press I to print it)
+typedef struct sCullStats
+{
+	int triangles; //of the mesh
+	int outside; //all of it behind the near plane or past the far one, or the whole mesh outside the camera
+	int clipped; //crossing a plane, only the pieces that are left go on
+	int faces; //culled by CULL_BACK or CULL_FRONT
+	int zero_area;
+	int subpixel; //not covering any pixel center
+	int binned; //triangles and pieces sent to the raster stage
+} CullStats;
 
 class Application
 {
@@ -23,7 +54,8 @@ public:
 
 	float time;
 	Image framebuffer;
-	FloatImage zbuffer;
+	DepthBuffer zbuffer;
+	GBuffer gbuffer; //only used by the deferred mode
 
 	Mesh* mesh = NULL;
 	Camera* camera = NULL;
@@ -31,6 +63,35 @@ public:
 	int mode;
 	
 	Image* texture_normal = NULL;
+	int cull_mode = CULL_BACK | CULL_DEGENERATE; //CULL_* flags for the mesh (the wireframe draws every triangle), press C to switch the back face culling
+	CullStats cull_stats;
+
+	//vertex already projected to framebuffer coordinates by the geometry stage
+	typedef struct sScreenVertex {
+		int x;
+		int y;
+		float z;
+		int clip; //CLIP_* flags, the triangles with any of them go through Application::clipTriangle
+	} ScreenVertex;
+
+	//triangle already projected to framebuffer coordinates by the geometry stage
+	typedef struct sScreenTriangle {
+		int x[3];
+		int y[3];
+		float z[3];
+		Vector2 uv[3];
+		int id; //triangle of the mesh it comes from, -1 if it was clipped (its pieces are in clipped_triangles), culled or discarded
+	} ScreenTriangle;
+
+	//multithreaded renderer: the geometry stage projects the triangles and sorts them into screen bins,
+	//then every bin is rasterized by a single thread so no two threads write the same pixel
+	ThreadPool* pool = NULL;
+	std::vector<ScreenVertex> screen_vertices; //one per vertex of the mesh, so the shared ones are projected only once
+	std::vector<ScreenTriangle> screen_triangles;
+	std::vector< std::vector<ScreenTriangle> > clipped_triangles; //pieces of the clipped triangles, one list per geometry chunk
+	std::vector< std::vector<int> > bins; //triangle indices, one list per geometry chunk and bin: [chunk * num_bins + bin]. Negative ones are -(n+1) for clipped_triangles[chunk][n]
+	int bins_x;
+	int bins_y;
 
 	//keyboard state
 	const Uint8* keystate;
@@ -47,6 +108,11 @@ public:
 	void init( void );
 	void render( Image& framebuffer );
 	void update( double dt );
+	void projectAndBinTriangles( Image& framebuffer, int cull );
+	void clipTriangle( Image& framebuffer, int triangle, int cull, std::vector<ScreenTriangle>& pieces, CullStats& stats );
+	bool binTriangle( Image& framebuffer, const ScreenTriangle& t, int index, std::vector<int>* chunk_bins );
+	void rasterizeBin( Image& framebuffer, int bin );
+	bool checkSimdShading(); //press T: renders the frame with the AVX2 and the scalar shading and compares them
 
 	//methods for events
 	void onKeyDown( SDL_KeyboardEvent event );
@@ -60,6 +126,7 @@ public:
 		this->window_width = width;
 		this->window_height = height;
 		zbuffer.resize(width, height);
+		gbuffer.resize(width, height);
 		framebuffer.resize(width, height);
 	}
 
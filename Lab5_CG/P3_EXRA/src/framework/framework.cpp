@@ -6,6 +6,7 @@
 #include <math.h> //atan2
 
 
+
 #define M_PI_2 1.57079632679489661923
 
 
@@ -280,6 +281,20 @@ Matrix44 Matrix44::operator*(const Matrix44& matrix) const
 {
 	Matrix44 ret;
 
+#ifdef FRAMEWORK_SSE
+	//every row of the result is the rows of the other matrix weighted by this row, the sums are done in the same order as below
+	__m128 rows[4];
+	for (int k = 0; k < 4; k++)
+		rows[k] = _mm_loadu_ps(matrix.M[k]);
+	for (int i = 0; i < 4; i++)
+	{
+		__m128 row = _mm_mul_ps(_mm_set1_ps(M[i][0]), rows[0]);
+		row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(M[i][1]), rows[1]));
+		row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(M[i][2]), rows[2]));
+		row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(M[i][3]), rows[3]));
+		_mm_storeu_ps(ret.M[i], row);
+	}
+#else
 	unsigned int i,j,k;
 	for (i=0;i<4;i++) 	
 	{
@@ -290,10 +305,55 @@ Matrix44 Matrix44::operator*(const Matrix44& matrix) const
 				ret.M[i][j] += M[i][k] * matrix.M[k][j];
 		}
 	}
+#endif
 
 	return ret;
 }
 
+void Matrix44::projectPoints(const float* x, const float* y, const float* z, int count, float width, float height, float* screen_x, float* screen_y, float* screen_z, float* clip_w) const
+{
+	float half_width = width * 0.5f;
+	float half_height = height * 0.5f;
+	int i = 0;
+
+#ifdef FRAMEWORK_SSE
+	//4 points at a time, with the same operations (and order) as the scalar loop so both give the same result
+	__m128 c[16];
+	for (int k = 0; k < 16; k++)
+		c[k] = _mm_set1_ps(m[k]);
+	__m128 hw = _mm_set1_ps(half_width);
+	__m128 hh = _mm_set1_ps(half_height);
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 px = _mm_loadu_ps(x + i);
+		__m128 py = _mm_loadu_ps(y + i);
+		__m128 pz = _mm_loadu_ps(z + i);
+		__m128 tx = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(c[0], px), _mm_mul_ps(c[4], py)), _mm_mul_ps(c[8], pz)), c[12]);
+		__m128 ty = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(c[1], px), _mm_mul_ps(c[5], py)), _mm_mul_ps(c[9], pz)), c[13]);
+		__m128 tz = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(c[2], px), _mm_mul_ps(c[6], py)), _mm_mul_ps(c[10], pz)), c[14]);
+		__m128 tw = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(c[3], px), _mm_mul_ps(c[7], py)), _mm_mul_ps(c[11], pz)), c[15]);
+		_mm_storeu_ps(screen_x + i, _mm_add_ps(_mm_mul_ps(hw, _mm_div_ps(tx, tw)), hw));
+		_mm_storeu_ps(screen_y + i, _mm_add_ps(_mm_mul_ps(hh, _mm_div_ps(ty, tw)), hh));
+		_mm_storeu_ps(screen_z + i, _mm_div_ps(tz, tw));
+		if (clip_w)
+			_mm_storeu_ps(clip_w + i, tw);
+	}
+#endif
+
+	for (; i < count; i++)
+	{
+		float tx = m[0] * x[i] + m[4] * y[i] + m[8] * z[i] + m[12];
+		float ty = m[1] * x[i] + m[5] * y[i] + m[9] * z[i] + m[13];
+		float tz = m[2] * x[i] + m[6] * y[i] + m[10] * z[i] + m[14];
+		float tw = m[3] * x[i] + m[7] * y[i] + m[11] * z[i] + m[15];
+		screen_x[i] = half_width * (tx / tw) + half_width;
+		screen_y[i] = half_height * (ty / tw) + half_height;
+		screen_z[i] = tz / tw;
+		if (clip_w)
+			clip_w[i] = tw;
+	}
+}
+
 //it allows to add two vectors
 Vector3 operator + (const Vector3& a, const Vector3& b) 
 {
@@ -8,6 +8,12 @@
 #include <vector>
 #include <cmath>
 
+//SSE is in every x86 CPU with 64 bits (and any 32 bits one built with it), there is no need to check for it at runtime
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+	#include <xmmintrin.h>
+	#define FRAMEWORK_SSE
+#endif
+
 #ifndef PI
 #define PI 3.14159265359
 #endif
@@ -162,6 +168,11 @@ class Matrix44
 		void setRotation( float angle_in_rad, const Vector3& axis );
 
 		Matrix44 operator * (const Matrix44& matrix) const;
+
+		//transforms count points (x, y and z in separate arrays, w = 1) with this matrix, divides them by w and maps them to a
+		//viewport of width x height: screen_x and screen_y in pixels, screen_z the normalized depth. Uses SSE, 4 points at a time.
+		//If clip_w is given it also stores the w of every point before the division (<= 0 if it is behind the camera)
+		void projectPoints(const float* x, const float* y, const float* z, int count, float width, float height, float* screen_x, float* screen_y, float* screen_z, float* clip_w = NULL) const;
 };
 
 //Operators, they are our friends
@@ -1,6 +1,10 @@
 #include "image.h"
+#include <vector>
 #include "light.h"
 #include "material.h"
+#include <cstdlib>
+
+bool Image::simd_shading = false;
 
 Image::Image() {
 	width = 0; height = 0;
@@ -69,6 +73,93 @@ void Image::resize(unsigned int width, unsigned int height)
 	pixels = new_pixels;
 }
 
+DepthBuffer::~DepthBuffer()
+{
+	if (tile_max)
+		delete[] tile_max;
+}
+
+void DepthBuffer::resize(unsigned int width, unsigned int height)
+{
+	FloatImage::resize(width, height);
+
+	if (tile_max)
+		delete[] tile_max;
+	tiles_x = (width + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+	tiles_y = (height + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+	tile_max = new float[tiles_x * tiles_y];
+
+	for (unsigned int ty = 0; ty < tiles_y; ++ty)
+		for (unsigned int tx = 0; tx < tiles_x; ++tx)
+			updateTile(tx, ty);
+}
+
+void DepthBuffer::fill(const float& v)
+{
+	FloatImage::fill(v);
+	for (unsigned int pos = 0; pos < tiles_x * tiles_y; ++pos)
+		tile_max[pos] = v;
+}
+
+void DepthBuffer::fillRect(const ScreenRect& rect, const float& v)
+{
+	for (int y = rect.miny; y <= rect.maxy; ++y)
+		for (int x = rect.minx; x <= rect.maxx; ++x)
+			pixels[y * width + x] = v;
+
+	//tiles only partially inside the rect still have old pixels, so they are recomputed instead of set to v
+	for (int ty = rect.miny / RASTER_TILE_SIZE; ty <= rect.maxy / RASTER_TILE_SIZE; ++ty)
+		for (int tx = rect.minx / RASTER_TILE_SIZE; tx <= rect.maxx / RASTER_TILE_SIZE; ++tx)
+			updateTile(tx, ty);
+}
+
+void DepthBuffer::updateTile(int tile_x, int tile_y)
+{
+	unsigned int sx = tile_x * RASTER_TILE_SIZE, ex = std::min(sx + RASTER_TILE_SIZE, width);
+	unsigned int sy = tile_y * RASTER_TILE_SIZE, ey = std::min(sy + RASTER_TILE_SIZE, height);
+
+	float m = pixels[sy * width + sx];
+	for (unsigned int y = sy; y < ey; ++y)
+	{
+		const float* row = pixels + y * width;
+		for (unsigned int x = sx; x < ex; ++x)
+			m = std::max(m, row[x]);
+	}
+	tile_max[tile_y * tiles_x + tile_x] = m;
+}
+
+GBuffer::GBuffer()
+{
+	width = height = 0;
+	uvs = NULL;
+	ids = NULL;
+}
+
+GBuffer::~GBuffer()
+{
+	if (uvs) delete[] uvs;
+	if (ids) delete[] ids;
+}
+
+//the old content is not kept, every bin clears its area before drawing
+void GBuffer::resize(unsigned int width, unsigned int height)
+{
+	if (uvs) delete[] uvs;
+	if (ids) delete[] ids;
+	this->width = width;
+	this->height = height;
+	uvs = new Vector2[width * height];
+	ids = new int[width * height];
+	memset(ids, -1, width * height * sizeof(int));
+}
+
+void GBuffer::clearRect(const ScreenRect& rect)
+{
+	for (int y = rect.miny; y <= rect.maxy; ++y)
+		for (int x = rect.minx; x <= rect.maxx; ++x)
+			ids[y * width + x] = -1;
+}
+
 //change image size and scale the content
 void Image::scale(unsigned int width, unsigned int height)
 {
@@ -120,17 +211,117 @@ void Image::flipY()
 
 
 //Loads an image from a TGA file
+bool Image::checkTGAHeader(const unsigned char* header, bool& rle)
+{
+	//no id field, no color map and true color, uncompressed (type 2) or RLE (type 10)
+	static const unsigned char TGAheader[12] = {0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+	rle = header[2] == 10;
+	return memcmp(TGAheader, header, 2) == 0 && (header[2] == 2 || rle) && memcmp(TGAheader + 3, header + 3, 9) == 0;
+}
+
+bool Image::readTGAPixels(FILE* file, bool rle, unsigned char* data, unsigned int num_pixels, unsigned int bytes_per_pixel)
+{
+	size_t size = (size_t)num_pixels * bytes_per_pixel;
+	if (!rle)
+		return fread(data, 1, size, file) == size;
+
+	//the rest of the file is read at once and decoded in a single pass
+	long start = ftell(file);
+	fseek(file, 0, SEEK_END);
+	long end = ftell(file);
+	fseek(file, start, SEEK_SET);
+	if (end <= start)
+		return false;
+	std::vector<unsigned char> packed(end - start);
+	if (fread(&packed[0], 1, packed.size(), file) != packed.size())
+		return false;
+
+	//every packet starts with a byte: the high bit says if it is a run (one pixel repeated) or raw pixels, the other 7 bits are the count - 1
+	const unsigned char* src = &packed[0];
+	const unsigned char* src_end = src + packed.size();
+	unsigned char* dst = data;
+	unsigned char* dst_end = data + size;
+	while (dst < dst_end)
+	{
+		if (src >= src_end)
+			return false;
+		bool run = (*src & 0x80) != 0;
+		size_t bytes = ((*src & 0x7F) + 1) * bytes_per_pixel;
+		src++;
+		if (bytes > (size_t)(dst_end - dst))
+			return false; //corrupted, more pixels than the image has
+
+		if (run)
+		{
+			if ((size_t)(src_end - src) < bytes_per_pixel)
+				return false;
+			if (bytes_per_pixel == 4)
+			{
+				unsigned int pixel;
+				memcpy(&pixel, src, 4);
+				for (unsigned char* p = dst; p < dst + bytes; p += 4)
+					memcpy(p, &pixel, 4);
+			}
+			else
+			{
+				for (unsigned char* p = dst; p < dst + bytes; p += 3)
+				{
+					p[0] = src[0];
+					p[1] = src[1];
+					p[2] = src[2];
+				}
+			}
+			src += bytes_per_pixel;
+		}
+		else
+		{
+			if ((size_t)(src_end - src) < bytes)
+				return false;
+			memcpy(dst, src, bytes);
+			src += bytes;
+		}
+		dst += bytes;
+	}
+	return true;
+}
+
+//appends a row of BGR pixels as RLE packets, runs of 2 or more equal pixels are stored once. Packets never cross rows, as the format asks
+static void encodeTGARow(const unsigned char* row, unsigned int num_pixels, std::vector<unsigned char>& out)
+{
+	unsigned int i = 0;
+	while (i < num_pixels)
+	{
+		unsigned int count = 1;
+		while (i + count < num_pixels && count < 128 && memcmp(row + (i + count) * 3, row + i * 3, 3) == 0)
+			count++;
+		if (count > 1)
+		{
+			out.push_back(0x80 | (count - 1));
+			out.insert(out.end(), row + i * 3, row + i * 3 + 3);
+			i += count;
+			continue;
+		}
+
+		//raw pixels until two equal ones start a run
+		while (i + count < num_pixels && count < 128 && !(i + count + 1 < num_pixels && memcmp(row + (i + count) * 3, row + (i + count + 1) * 3, 3) == 0))
+			count++;
+		out.push_back(count - 1);
+		out.insert(out.end(), row + i * 3, row + (i + count) * 3);
+		i += count;
+	}
+}
+
 bool Image::loadTGA(const char* filename)
 {
-	unsigned char TGAheader[12] = {0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0};
 	unsigned char TGAcompare[12];
+	bool rle;
 	unsigned char header[6];
 	unsigned int bytesPerPixel;
 	unsigned int imageSize;
 
 	FILE * file = fopen(filename, "rb");
    	if ( file == NULL || fread(TGAcompare, 1, sizeof(TGAcompare), file) != sizeof(TGAcompare) ||
-		memcmp(TGAheader, TGAcompare, sizeof(TGAheader)) != 0 ||
+		!checkTGAHeader(TGAcompare, rle) ||
 		fread(header, 1, sizeof(header), file) != sizeof(header))
 	{
 		std::cerr << "File not found: " << filename << std::endl;
@@ -150,7 +341,7 @@ bool Image::loadTGA(const char* filename)
     
 	if (tgainfo->width <= 0 || tgainfo->height <= 0 || (header[4] != 24 && header[4] != 32))
 	{
-		std::cerr << "TGA file seems to have errors or it is compressed, only uncompressed TGAs supported" << std::endl;
+		std::cerr << "TGA file seems to have errors or it is not a true color image, only 24 and 32 bits TGAs supported" << std::endl;
 		fclose(file);
 		delete tgainfo;
 		return NULL;
@@ -162,7 +353,7 @@ bool Image::loadTGA(const char* filename)
     
 	tgainfo->data = new unsigned char[imageSize];
     
-	if (tgainfo->data == NULL || fread(tgainfo->data, 1, imageSize, file) != imageSize)
+	if (tgainfo->data == NULL || !readTGAPixels(file, rle, tgainfo->data, tgainfo->width * tgainfo->height, bytesPerPixel))
 	{
 		if (tgainfo->data != NULL)
 			delete tgainfo->data;
@@ -197,9 +388,11 @@ bool Image::loadTGA(const char* filename)
 }
 
 // Saves the image to a TGA file
-bool Image::saveTGA(const char* filename)
+bool Image::saveTGA(const char* filename, bool rle)
 {
 	unsigned char TGAheader[12] = {0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+	if (rle)
+		TGAheader[2] = 10;
 
 	FILE *file = fopen(filename, "wb");
 	if ( file == NULL )
@@ -233,7 +426,18 @@ bool Image::saveTGA(const char* filename)
 			bytes[pos] = c.b;
 		}
 
-	fwrite(bytes, 1, width*height*3, file);
+	if (rle)
+	{
+		std::vector<unsigned char> packed;
+		packed.reserve(width*height*3);
+		for(unsigned int y = 0; y < height; ++y)
+			encodeTGARow(bytes + y*width*3, width, packed);
+		if (packed.size())
+			fwrite(&packed[0], 1, packed.size(), file);
+	}
+	else
+		fwrite(bytes, 1, width*height*3, file);
+	delete[] bytes;
 	fclose(file);
 	return true;
 }
@@ -313,144 +517,12 @@ void forEachPixel(Image& img, const Image& img2, F f) {
 
 #endif
 
-void Image::init_table() {
-
-	table.resize(this->height);
-
-	for (int i = 0; i < height; i++) {
-		table[i].minx = 100000;
-		table[i].maxx = -100000;
-	}
-}
-void Image::breshenhamTable(int x0, int y0, int x1, int y1, Color c, std::vector<sCelda>& table) {
-	int dx, dy, inc_E, inc_NE, d, x, y;
-
-	int y_increment = 1;
-
-	if (x0 > x1) {
-		int aux = x0;
-		x0 = x1;
-		x1 = aux;
-
-		aux = y0;
-
-		y0 = y1;
-		y1 = aux;
-	}
-	x = x0;
-	y = y0;
-
-	dx = x1 - x0;
-	dy = y1 - y0;
-
-
-	if (dy < 0) {
-		y_increment = -1;
-		dy = -dy;
-	}
-	//Controlamos que los valores de la tabla se actualizen correctamente para cualquier x e y
-	if (y >= 0 && y < height) {
-		if (x < 0) {
-			table[y].minx = std::min(table[y].minx, 0);
-			table[y].maxx = std::max(table[y].maxx, x);
-		}
-		else if (x >= width) {
-			int a = width - 1;
-			table[y].minx = std::min(table[y].minx, x);
-			table[y].maxx = std::max(table[y].maxx, a);
-		}
-		else {
-			table[y].minx = std::min(table[y].minx, x);
-			table[y].maxx = std::max(table[y].maxx, x);
-		}
-	}
-
-	if (dx > dy) {
-		inc_E = 2 * dy;
-		inc_NE = 2 * (dy - dx);
-		d = 2 * dy - dx;
-
-		while (x < x1) {
-
-			if (d <= 0) {
-				d += inc_E;
-				x += 1;
-			}
-			else {
-				d += inc_NE;
-				y += y_increment;
-				x += 1;
-			}
-			//setPixel(x, y, c);
-		
-			if (y >= 0 && y < height) {
-				if (x < 0) {
-					table[y].minx = std::min(table[y].minx, 0);
-					table[y].maxx = std::max(table[y].maxx, x);
-				}
-				else if (x >= width) {
-					int a = width - 1;
-					table[y].minx = std::min(table[y].minx, x);
-					table[y].maxx = std::max(table[y].maxx, a);
-				}
-				else {
-					table[y].minx = std::min(table[y].minx, x);
-					table[y].maxx = std::max(table[y].maxx, x);
-				}
-			}
-			
-		}
-	}
-	else {
-
-		inc_E = 2 * dx;
-		inc_NE = 2 * (dx - dy);
-		d = 2 * dx - dy;
-		while (y != y1) { // A veces aumenta y a veces disminuye, por eso ponemos != para que cuando llegue pare(no < o > ya que depende de cada caso)
-			if (d <= 0) {
-				d += inc_E;
-				y += y_increment;
-			}
-			else {
-				d += inc_NE;
-				x += 1;
-				y += y_increment;
-			}
-			//setPixel(x, y, c);
-			if (y >= 0 && y < height) {
-				if (x < 0) {
-					table[y].minx = std::min(table[y].minx, 0);
-					table[y].maxx = std::max(table[y].maxx, x);
-				}
-				else if (x >= width) {
-					int a = width - 1;
-					table[y].minx = std::min(table[y].minx, x);
-					table[y].maxx = std::max(table[y].maxx, a);
-				}
-				else {
-					table[y].minx = std::min(table[y].minx, x);
-					table[y].maxx = std::max(table[y].maxx, x);
-				}
-			}
-			
-		}
-	}
-}
-
-void Image::drawTriangle(int x0, int y0, int x1, int y1, int x2, int y2, Color c, bool fill) {
-	init_table();
+void Image::drawTriangle(int x0, int y0, int x1, int y1, int x2, int y2, Color c, bool fill, const ScreenRect* clip) {
 
 	if (fill) {
-		breshenhamTable(x0, y0, x1, y1, c, table);
-		breshenhamTable(x1, y1, x2, y2, c, table);
-		breshenhamTable(x2, y2, x0, y0, c, table);
-		for (int i = 0; i < height; i++) {
-			if (table[i].maxx >= table[i].minx) {
-				for (int j = table[i].minx; j <= table[i].maxx; j++) {
-					setPixel(j, i, c);
-				}
-			}
-		}
+		rasterizeTriangle(x0, y0, x1, y1, x2, y2, [&](int x, int y, float /*u*/, float /*v*/, float /*w*/) {
+			setPixel(x, y, c);
+		}, clip);
 	}
 	else {
 		drawLineBresenham(x0, y0, x1, y1, c);
@@ -459,206 +531,159 @@ void Image::drawTriangle(int x0, int y0, int x1, int y1, int x2, int y2, Color c
 	}
 
 }
-void Image::drawTriangleInterpolated_color(int x0, int y0, int x1, int y1, int x2, int y2, float z0, float z1, float z2, FloatImage* zbuffer, Color c0, Color c1, Color c2) {
-
-	init_table();
-
-	breshenhamTable(x0, y0, x1, y1, Color::BLUE, table);
-	breshenhamTable(x1, y1, x2, y2, Color::RED, table);
-	breshenhamTable(x2, y2, x0, y0, Color::GREEN, table);
+void Image::drawTriangleInterpolated_color(int x0, int y0, int x1, int y1, int x2, int y2, float z0, float z1, float z2, DepthBuffer* zbuffer, Color c0, Color c1, Color c2, const ScreenRect* clip) {
 
+	rasterizeTriangle(x0, y0, x1, y1, x2, y2, [&](int x, int y, float u, float v, float w) {
+		float z = z0 * u + z1 * v + z2 * w;
+		float& z_2 = zbuffer->getPixelRef(x, y);
 
-	Vector2 v0 = Vector2(x1 - x0, y1 - y0);
-	Vector2 v1 = Vector2(x2 - x0, y2 - y0);
+		if (z < z_2) {
+			z_2 = z;
 
+			Color c = c0 * u + c1 * v + c2 * w;
 
-	for (int i = 0; i < height; i++) {
-		if (table[i].maxx >= table[i].minx) {
-			for (int j = table[i].minx; j <= table[i].maxx; j++) { 
-
-				Vector2 v2 = Vector2(j - x0, i - y0);
-				float d00 = v0.dot(v0);
-				float d01 = v0.dot(v1);
-				float d11 = v1.dot(v1);
-				float d20 = v2.dot(v0);
-				float d21 = v2.dot(v1);
-
-				float denom = d00 * d11 - d01 * d01;
-				float v = (d11 * d20 - d01 * d21) / denom;
-				float w = (d00 * d21 - d01 * d20) / denom;
-				float u = 1.0 - v - w;
-				float z = z0 * u + z1 * v + z2 * w;
-				float z_2 = getPixel_zbuffer(j, i, zbuffer);
-
-				if (v >= 0 && v <= 1.0 && u >= 0 && u <= 1 && w >= 0 && w <= 1) {
-					if (z < z_2) {
-						setPixel_zbuffer(j, i, z, zbuffer);
-						
-						Color c = c0 * u + c1 * v + c2 * w;;
-
-						paint_pixel(j, i, c);
-
-					}
-
-				}
-
-			}
+			setPixel(x, y, c);
 		}
-	}
+	}, clip, zbuffer, z0, z1, z2);
 }
 
-void Image::drawTriangleInterpolated(int x0, int y0, int x1, int y1, int x2, int y2, float z0, float z1, float z2, FloatImage* zbuffer, Vector2 tex1, Vector2 tex2, Vector2 tex3, Image* texture) {
-
-	init_table();
-
-	breshenhamTable(x0, y0, x1, y1, Color::BLUE, table);
-	breshenhamTable(x1, y1, x2, y2, Color::RED, table);
-	breshenhamTable(x2, y2, x0, y0, Color::GREEN, table);
-
-
-	Vector2 v0 = Vector2(x1 - x0, y1 - y0);
-	Vector2 v1 = Vector2(x2 - x0, y2 - y0);
-
-
-	float d00 = v0.dot(v0);
-	float d01 = v0.dot(v1);
-	float d11 = v1.dot(v1);
-
-
-
-
-	for (int i = 0; i < height; i++) {
-		if (table[i].maxx >= table[i].minx) {
-			for (int j = table[i].minx; j <= table[i].maxx; j++) {
-
-				Vector2 v2 = Vector2(j - x0, i - y0);
-				float d20 = v2.dot(v0);
-				float d21 = v2.dot(v1);
-
-				float denom = d00 * d11 - d01 * d01;
-
-				float v = (d11 * d20 - d01 * d21) / denom;
-				float w = (d00 * d21 - d01 * d20) / denom;
-				float u = 1.0 - v - w;
-
-				float z = z0 * u + z1 * v + z2 * w;
-				float z_2 = getPixel_zbuffer(j, i, zbuffer);
-
-				if (v >= -0.05 && v <= 1.05 && u >= -0.05 && u <= 1.05 && w >= -0.05 && w <= 1.05) {
-					if (z < z_2) {
-						setPixel_zbuffer(j, i, z, zbuffer);
-						int texture_x = (tex1.x * u + tex2.x * v + tex3.x * w) * texture->width;
-						int texture_y = (tex1.y * u + tex2.y * v + tex3.y * w) * texture->height;
-						Color c = getPixel_text(texture_x, texture_y, texture);
+void Image::drawTriangleInterpolated(int x0, int y0, int x1, int y1, int x2, int y2, float z0, float z1, float z2, DepthBuffer* zbuffer, Vector2 tex1, Vector2 tex2, Vector2 tex3, Image* texture, const ScreenRect* clip) {
 
-						paint_pixel(j, i, c);
+	rasterizeTriangle(x0, y0, x1, y1, x2, y2, [&](int x, int y, float u, float v, float w) {
+		float z = z0 * u + z1 * v + z2 * w;
+		float& z_2 = zbuffer->getPixelRef(x, y);
 
-					}
+		if (z < z_2) {
+			z_2 = z;
+			int texture_x = (tex1.x * u + tex2.x * v + tex3.x * w) * texture->width;
+			int texture_y = (tex1.y * u + tex2.y * v + tex3.y * w) * texture->height;
+			Color c = getPixel_text(texture_x, texture_y, texture);
 
-				}
-
-			}
+			setPixel(x, y, c);
 		}
-	}
+	}, clip, zbuffer, z0, z1, z2);
 }
 Vector3 Image::reflect(Vector3 i, Vector3 n) {
 	return (n * (2.0 * clamp(i.dot(n), 0.0, 1.0))) - i;
 
 }
 
-void Image::PhongIlluminationTexture(int x0, int y0, int x1, int y1, int x2, int y2, float z0, float z1, float z2, FloatImage* zbuffer, Material* material, Light* light, Vector3 cam_pos, Vector2 tex1, Vector2 tex2, Vector2 tex3, Image* texture, Image* texture_normal) {
-	init_table();
+void Image::PhongIlluminationTexture(int x0, int y0, int x1, int y1, int x2, int y2, float z0, float z1, float z2, DepthBuffer* zbuffer, Material* material, Light* light, Vector3 cam_pos, Vector2 tex1, Vector2 tex2, Vector2 tex3, Image* texture, Image* texture_normal, const ScreenRect* clip) {
+	bool fits = abs(x0) < SIMD_MAX_COORD && abs(y0) < SIMD_MAX_COORD && abs(x1) < SIMD_MAX_COORD && abs(y1) < SIMD_MAX_COORD && abs(x2) < SIMD_MAX_COORD && abs(y2) < SIMD_MAX_COORD;
+	bool textures_ok = texture->width * texture->height >= 2 && texture_normal->width * texture_normal->height >= 2;
 
-	breshenhamTable(x0, y0, x1, y1, Color::BLUE, table);
-	breshenhamTable(x1, y1, x2, y2, Color::RED, table);
-	breshenhamTable(x2, y2, x0, y0, Color::GREEN, table);
+	if (simd_shading && fits && textures_ok)
+		PhongIlluminationTexture_avx2(x0, y0, x1, y1, x2, y2, z0, z1, z2, zbuffer, material, light, cam_pos, tex1, tex2, tex3, texture, texture_normal, clip);
+	else
+		PhongIlluminationTexture_scalar(x0, y0, x1, y1, x2, y2, z0, z1, z2, zbuffer, material, light, cam_pos, tex1, tex2, tex3, texture, texture_normal, clip);
+}
 
-	Vector3 v0 = Vector3(x1 - x0, y1 - y0, z1 - z0);
-	Vector3 v1 = Vector3(x2 - x0, y2 - y0, z2 - z0);
+void Image::PhongIlluminationTexture_scalar(int x0, int y0, int x1, int y1, int x2, int y2, float z0, float z1, float z2, DepthBuffer* zbuffer, Material* material, Light* light, Vector3 cam_pos, Vector2 tex1, Vector2 tex2, Vector2 tex3, Image* texture, Image* texture_normal, const ScreenRect* clip) {
 
+	rasterizeTriangle(x0, y0, x1, y1, x2, y2, [&](int j, int i, float u, float v, float w) {
+		float z = z0 * u + z1 * v + z2 * w;
+		float& z_2 = zbuffer->getPixelRef(j, i);
 
-	float d00 = v0.dot(v0);
-	float d01 = v0.dot(v1);
-	float d11 = v1.dot(v1);
+		if (z < z_2) {
+			z_2 = z;
 
-	for (int i = 0; i < height; i++) {
-		if (table[i].maxx >= table[i].minx) {
-			for (int j = table[i].minx; j <= table[i].maxx; j++) {
+			float tex_x = tex1.x * u + tex2.x * v + tex3.x * w;
+			float tex_y = tex1.y * u + tex2.y * v + tex3.y * w;
+			setPixel(j, i, PhongIlluminationPixel(j, i, z, tex_x, tex_y, material, light, cam_pos, texture, texture_normal));
+		}
+	}, clip, zbuffer, z0, z1, z2);
+}
 
-				Vector3 v2 = Vector3(j - x0, i - y0, 1);
-				float d20 = v2.dot(v0);
-				float d21 = v2.dot(v1);
+//phong lighting of one pixel, tex_x and tex_y being its texture coordinates (from 0,0 to 1,1)
+Color Image::PhongIlluminationPixel(int x, int y, float z, float tex_x, float tex_y, Material* material, Light* light, Vector3 cam_pos, Image* texture, Image* texture_normal) {
+	int texture_x = tex_x * (texture->width-1);
+	int texture_y = tex_y * (texture->height-1);
 
-				float denom = d00 * d11 - d01 * d01;
+	Color c1 = getPixel_text(texture_x, texture_y, texture);
 
-				float v = (d11 * d20 - d01 * d21) / denom;
-				float w = (d00 * d21 - d01 * d20) / denom;
-				float u = 1.0 - v - w;
+	int texture_normal_x = tex_x * (texture_normal->width-1);
+	int texture_normal_y = tex_y * (texture_normal->height-1);
 
+	Color c2 = getPixel_text(texture_normal_x, texture_normal_y, texture_normal);
 
-				float z = z0 * u + z1 * v + z2 * w;
-				float z_2 = getPixel_zbuffer(j, i, zbuffer);
+	float c1_r = float(c1.r / 255.0);
+	float c1_g = float(c1.g / 255.0);
+	float c1_b = float(c1.b / 255.0);
 
-				if (z < z_2 && v >= -0.05 && v <= 1.05 && u >= -0.05 && u <= 1.05 && w >= -0.05 && w <= 1.05) {
-					setPixel_zbuffer(j, i, z, zbuffer);
+	float c2_r = float(c2.r / 255.0);
+	float c2_g = float(c2.g / 255.0);
+	float c2_b = float(c2.b / 255.0);
 
-					int texture_x = (tex1.x * u + tex2.x * v + tex3.x * w) * (texture->width-1);
-					int texture_y = (tex1.y * u + tex2.y * v + tex3.y * w) * (texture->height-1);
+	//No multipliquem per la model ja que no mourem la mesh, mourem el punt de vista.
+	Vector3 N = Vector3(c2_r, c2_g, c2_b);
+	N.normalize();
 
-					Color c1 = getPixel_text(texture_x, texture_y, texture);
+	Vector3 L = light->position - Vector3(x, y, z);
+	L.normalize();
 
-					int texture_normal_x = (tex1.x * u + tex2.x * v + tex3.x * w) * (texture_normal->width-1);
-					int texture_normal_y = (tex1.y * u + tex2.y * v + tex3.y * w) * (texture_normal->height-1);
+	Vector3 V = cam_pos - Vector3(x, y, z);
+	V.normalize();
 
-					
 
-					Color c2 = getPixel_text(texture_normal_x, texture_normal_y, texture_normal);
-				   
+	Vector3 R = reflect(L, N);
+	R.x * -1;
+	R.y * -1;
+	R.z * -1;
+	R.normalize();
 
-					float c1_r = float(c1.r / 255.0);
-					float c1_g = float(c1.g / 255.0);
-					float c1_b = float(c1.b / 255.0);
 
-					float c2_r = float(c2.r / 255.0);
-					float c2_g = float(c2.g / 255.0);
-					float c2_b = float(c2.b / 255.0);
+	Vector3 ambient_light(0.1, 0.1, 0.1);
 
-					
-					//No multipliquem per la model ja que no mourem la mesh, mourem el punt de vista.
-					Vector3 N = Vector3(c2_r, c2_g, c2_b);
-					N.normalize();
 
-					Vector3 L = light->position - Vector3(j, i, z);
-					L.normalize();
+	Vector3 diffuse = Vector3(material->diffuse.x * light->diffuse_color.x * c1_r, material->diffuse.y * light->diffuse_color.y * c1_g, material->diffuse.z * light->diffuse_color.z * c1_b) * clamp(-L.dot(N), 0.0, 1.0);
+	Vector3 specular = Vector3(material->specular.x * light->specular_color.x * c1_r, material->specular.y * light->specular_color.y * c1_g, material->specular.z * light->specular_color.z * c1_b) * pow(std::max((float)R.dot(V), float(0)), material->shininess);
+	Vector3 ambient = Vector3(material->ambient.x * ambient_light.x * c1_r, material->ambient.y * ambient_light.y * c1_g, material->ambient.z * ambient_light.z * c1_b);
 
-					Vector3 V = cam_pos - Vector3(j, i, z);
-					V.normalize();
+	Vector3 Ip = diffuse + specular + ambient;
 
 
-					Vector3 R = reflect(L, N);
-					R.x * -1;
-					R.y * -1;
-					R.z * -1;
-					R.normalize();
+	return Color(Ip.x * 255, Ip.y * 255, Ip.z * 255);
+}
 
+//raster pass of the deferred mode: only the depth, the texture coordinates and the triangle id of the closest triangle are stored
+void Image::drawTriangleGBuffer(int x0, int y0, int x1, int y1, int x2, int y2, float z0, float z1, float z2, DepthBuffer* zbuffer, Vector2 tex1, Vector2 tex2, Vector2 tex3, GBuffer* gbuffer, int id, const ScreenRect* clip) {
 
-					Vector3 ambient_light(0.1, 0.1, 0.1);
+	rasterizeTriangle(x0, y0, x1, y1, x2, y2, [&](int x, int y, float u, float v, float w) {
+		float z = z0 * u + z1 * v + z2 * w;
+		float& z_2 = zbuffer->getPixelRef(x, y);
 
+		if (z < z_2) {
+			z_2 = z;
 
-					Vector3 diffuse = Vector3(material->diffuse.x * light->diffuse_color.x * c1_r, material->diffuse.y * light->diffuse_color.y * c1_g, material->diffuse.z * light->diffuse_color.z * c1_b) * clamp(-L.dot(N), 0.0, 1.0);
-					Vector3 specular = Vector3(material->specular.x * light->specular_color.x * c1_r, material->specular.y * light->specular_color.y * c1_g, material->specular.z * light->specular_color.z * c1_b) * pow(std::max((float)R.dot(V), float(0)), material->shininess);
-					Vector3 ambient = Vector3(material->ambient.x * ambient_light.x * c1_r, material->ambient.y * ambient_light.y * c1_g, material->ambient.z * ambient_light.z * c1_b);
+			int pos = y * gbuffer->width + x;
+			gbuffer->uvs[pos] = Vector2(tex1.x * u + tex2.x * v + tex3.x * w, tex1.y * u + tex2.y * v + tex3.y * w);
+			gbuffer->ids[pos] = id;
+		}
+	}, clip, zbuffer, z0, z1, z2);
+}
 
-					Vector3 Ip = diffuse + specular + ambient;
+//lighting pass of the deferred mode: shades once every pixel of rect covered by a triangle
+void Image::PhongIlluminationGBuffer(DepthBuffer* zbuffer, GBuffer* gbuffer, Material* material, Light* light, Vector3 cam_pos, Image* texture, Image* texture_normal, const ScreenRect& rect) {
+	bool textures_ok = texture->width * texture->height >= 2 && texture_normal->width * texture_normal->height >= 2;
 
+	if (simd_shading && textures_ok)
+		PhongIlluminationGBuffer_avx2(zbuffer, gbuffer, material, light, cam_pos, texture, texture_normal, rect);
+	else
+		PhongIlluminationGBuffer_scalar(zbuffer, gbuffer, material, light, cam_pos, texture, texture_normal, rect);
+}
 
-					Color color = Color(Ip.x * 255, Ip.y * 255, Ip.z * 255);
-					paint_pixel(j, i, color);
+void Image::PhongIlluminationGBuffer_scalar(DepthBuffer* zbuffer, GBuffer* gbuffer, Material* material, Light* light, Vector3 cam_pos, Image* texture, Image* texture_normal, const ScreenRect& rect) {
 
-				}
-			}
+	for (int y = rect.miny; y <= rect.maxy; y++)
+		for (int x = rect.minx; x <= rect.maxx; x++)
+		{
+			int pos = y * gbuffer->width + x;
+			if (gbuffer->ids[pos] < 0)
+				continue; //background
+
+			Vector2 uv = gbuffer->uvs[pos];
+			setPixel(x, y, PhongIlluminationPixel(x, y, zbuffer->getPixel(x, y), uv.x, uv.y, material, light, cam_pos, texture, texture_normal));
 		}
-	}
 }
 
 void Image::drawLineBresenham(int x0, int y0, int x1, int y1, Color c) {
@@ -729,6 +754,43 @@ void Image::drawLineBresenham(int x0, int y0, int x1, int y1, Color c) {
 	}
 }
 
+bool Image::coversPixel(int x0, int y0, int x1, int y1, int x2, int y2)
+{
+	long long area = (long long)(x1 - x0) * (y2 - y0) - (long long)(y1 - y0) * (x2 - x0);
+	if (area == 0)
+		return false;
+
+	int minx = std::min(x0, std::min(x1, x2));
+	int miny = std::min(y0, std::min(y1, y2));
+	int maxx = std::max(x0, std::max(x1, x2));
+	int maxy = std::max(y0, std::max(y1, y2));
+	if (maxx - minx > RASTER_SUBPIXEL_BOX || maxy - miny > RASTER_SUBPIXEL_BOX)
+		return true;
+
+	//the edge functions of rasterizeTriangle, with the same bias for the pixels on an edge
+	int vx[3] = { x0, x1, x2 };
+	int vy[3] = { y0, y1, y2 };
+	long long sign = area > 0 ? 1 : -1;
+	long long A[3], B[3], C[3];
+	for (int i = 0; i < 3; i++)
+	{
+		int a = (i + 1) % 3, b = (i + 2) % 3;
+		A[i] = sign * (vy[a] - vy[b]);
+		B[i] = sign * (vx[b] - vx[a]);
+		C[i] = -(A[i] * vx[a] + B[i] * vy[a]) + ((A[i] > 0 || (A[i] == 0 && B[i] > 0)) ? 0 : -1);
+	}
+	for (int y = miny; y <= maxy; y++)
+		for (int x = minx; x <= maxx; x++)
+		{
+			long long e0 = A[0] * x + B[0] * y + C[0];
+			long long e1 = A[1] * x + B[1] * y + C[1];
+			long long e2 = A[2] * x + B[2] * y + C[2];
+			if ((e0 | e1 | e2) >= 0)
+				return true;
+		}
+	return false;
+}
+
 //Funciones para asegurarnos la entrada de valores correctos
 void Image::paint_pixel(int x, int y, Color c) {
 	if (x >= 0 && x < width && y>=0 && y < height) {
@@ -10,6 +10,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <iostream>
+#include <algorithm>
 #include "framework.h"
 #include "light.h"
 #include "material.h"
@@ -18,7 +19,98 @@
 #define _CRT_SECURE_NO_WARNINGS
 #pragma warning(disable:4996)
 
-class FloatImage;
+//side in pixels of the square tiles the triangle rasterizer works with (must be a power of two)
+#define RASTER_TILE_SIZE 8
+//margin used when comparing the nearest depth of a triangle in a tile with the farthest depth stored for that tile
+#define RASTER_HIZ_EPSILON 1e-5
+//largest bounding box (in pixels) of the triangles Image::coversPixel checks one pixel at a time
+#define RASTER_SUBPIXEL_BOX 2
+//the 8-wide shading path keeps the edge functions in 32 bit integers, so it only takes triangles with all their vertices inside this range
+#define SIMD_MAX_COORD 8192
+//largest difference allowed in any channel of a pixel between the 8-wide and the scalar shading (Application::checkSimdShading)
+#define SIMD_SHADING_TOLERANCE 4
+
+//area of the image (bounds included) where a triangle is allowed to write, used to split the framebuffer between threads
+typedef struct sScreenRect
+{
+	int minx, miny;
+	int maxx, maxy;
+} ScreenRect;
+
+//Image that stores one float per pixel instead of a Color, like a matrix, useful for a Depth Buffer
+class FloatImage
+{
+public:
+	unsigned int width;
+	unsigned int height;
+	float* pixels;
+
+	// CONSTRUCTORS 
+	FloatImage() { width = height = 0; pixels = NULL; }
+	FloatImage(unsigned int width, unsigned int height);
+	FloatImage(const FloatImage& c);
+	FloatImage& operator = (const FloatImage& c); //assign operator
+
+	//destructor
+	~FloatImage();
+
+	void fill(const float& v) { for(unsigned int pos = 0; pos < width*height; ++pos) pixels[pos] = v; }
+
+	//get the pixel at position x,y
+	float getPixel(unsigned int x, unsigned int y) const { return pixels[y * width + x]; }
+	float& getPixelRef(unsigned int x, unsigned int y) { return pixels[y * width + x]; }
+
+	//set the pixel at position x,y with value C
+	inline void setPixel(unsigned int x, unsigned int y, const float& v) { pixels[y * width + x] = v; }
+
+	void resize(unsigned int width, unsigned int height);
+};
+
+//Depth buffer that also keeps the farthest depth of every RASTER_TILE_SIZE tile (a one level hierarchical Z),
+//so the rasterizer can throw away the tiles of a triangle that are behind everything already drawn there.
+//The tile values are always >= the real farthest depth of the tile, they are recomputed after the tile is drawn.
+class DepthBuffer : public FloatImage
+{
+public:
+	unsigned int tiles_x;
+	unsigned int tiles_y;
+	float* tile_max;
+
+	DepthBuffer() { tiles_x = tiles_y = 0; tile_max = NULL; }
+	~DepthBuffer();
+
+	void resize(unsigned int width, unsigned int height);
+	void fill(const float& v);
+	void fillRect(const ScreenRect& rect, const float& v); //fills the pixels inside rect (bounds included) and refreshes their tiles
+
+	float getTileMax(int tile_x, int tile_y) const { return tile_max[tile_y * tiles_x + tile_x]; }
+	void updateTile(int tile_x, int tile_y); //recomputes the farthest depth of a tile from its pixels
+
+private:
+	DepthBuffer(const DepthBuffer& c);
+	DepthBuffer& operator = (const DepthBuffer& c);
+};
+
+//Per pixel data of the closest triangle, written by the raster pass of the deferred renderer and read by its lighting pass.
+//The depth is kept in the DepthBuffer
+class GBuffer
+{
+public:
+	unsigned int width;
+	unsigned int height;
+	Vector2* uvs; //interpolated texture coordinates
+	int* ids; //triangle drawn in the pixel, -1 if none
+
+	GBuffer();
+	~GBuffer();
+
+	void resize(unsigned int width, unsigned int height);
+	void clearRect(const ScreenRect& rect); //marks the pixels inside rect (bounds included) as empty
+
+private:
+	GBuffer(const GBuffer& c);
+	GBuffer& operator = (const GBuffer& c);
+};
 
 //Class Image: to store a matrix of pixels
 class Image
@@ -31,16 +123,15 @@ class Image
 		unsigned int bpp; //bits per pixel
 		unsigned char* data; //bytes with the pixel information 
 	} TGAInfo;
-	struct sCelda {
-		int minx;
-		int maxx;
-	};
 
 public:
 	unsigned int width;
 	unsigned int height;
 	Color* pixels;
-	std::vector<sCelda> table;
+
+	//use the AVX2 shading path when possible (set it only if the CPU supports it)
+	static bool simd_shading;
+
 	// CONSTRUCTORS 
 	Image();
 	Image(unsigned int width, unsigned int height);
@@ -75,9 +166,13 @@ public:
 	//returns a new image with the area from (startx,starty) of size width,height
 	Image getArea(unsigned int start_x, unsigned int start_y, unsigned int width, unsigned int height);
 
-	//save or load images from the hard drive
+	//save or load images from the hard drive, they can be uncompressed or RLE TGAs
 	bool loadTGA(const char* filename);
-	bool saveTGA(const char* filename);
+	bool saveTGA(const char* filename, bool rle = false);
+
+	//TGA parts shared with the texture loader: the 12 first bytes of the header and the pixels after it
+	static bool checkTGAHeader(const unsigned char* header, bool& rle);
+	static bool readTGAPixels(FILE* file, bool rle, unsigned char* data, unsigned int num_pixels, unsigned int bytes_per_pixel);
 
 	//used to easy code
 	#ifndef IGNORE_LAMBDAS
@@ -93,18 +188,133 @@ public:
 		return *this;
 	}
 
+	//fills a triangle using half-space edge functions over its bounding box (clamped to the image or to clip if given).
+	//The box is walked in RASTER_TILE_SIZE x RASTER_TILE_SIZE tiles: tiles outside any edge are skipped and tiles
+	//fully inside all edges skip the per pixel test, so the cost depends on the covered area and not on the image height.
+	//The callback is called for every covered pixel as callback(x, y, u, v, w), u,v,w being the weights of vertex 0,1,2.
+	//If a depth buffer is given (z0,z1,z2 being the depth of the vertices), tiles where the triangle can not be closer
+	//than the farthest pixel already there are skipped before any weight is computed, and the tile depth is refreshed after.
+	template <typename F>
+	void rasterizeTriangle(int x0, int y0, int x1, int y1, int x2, int y2, F callback, const ScreenRect* clip = NULL, DepthBuffer* depth = NULL, float z0 = 0, float z1 = 0, float z2 = 0)
+	{
+		long long area = (long long)(x1 - x0) * (y2 - y0) - (long long)(y1 - y0) * (x2 - x0);
+		if (area == 0 || width == 0 || height == 0)
+			return; //degenerate triangle, nothing to fill
+
+		//bounding box clamped to the image (and to the clip rect)
+		int minx = std::max(std::min(x0, std::min(x1, x2)), 0);
+		int miny = std::max(std::min(y0, std::min(y1, y2)), 0);
+		int maxx = std::min(std::max(x0, std::max(x1, x2)), (int)width - 1);
+		int maxy = std::min(std::max(y0, std::max(y1, y2)), (int)height - 1);
+		if (clip)
+		{
+			minx = std::max(minx, clip->minx); miny = std::max(miny, clip->miny);
+			maxx = std::min(maxx, clip->maxx); maxy = std::min(maxy, clip->maxy);
+		}
+		if (minx > maxx || miny > maxy)
+			return;
+
+		//edge i is the one opposite to vertex i: E(x,y) = A*x + B*y + C, positive inside the triangle
+		int vx[3] = { x0, x1, x2 };
+		int vy[3] = { y0, y1, y2 };
+		long long sign = area > 0 ? 1 : -1;
+		long long A[3], B[3], C[3], bias[3];
+		for (int i = 0; i < 3; i++)
+		{
+			int a = (i + 1) % 3, b = (i + 2) % 3;
+			A[i] = sign * (vy[a] - vy[b]);
+			B[i] = sign * (vx[b] - vx[a]);
+			C[i] = -(A[i] * vx[a] + B[i] * vy[a]);
+			//pixels exactly on an edge only belong to one of the two triangles sharing it (no cracks, no double blending)
+			bias[i] = (A[i] > 0 || (A[i] == 0 && B[i] > 0)) ? 0 : -1;
+		}
+		float inv_area = 1.0f / (float)(area * sign);
+
+		//depth as a plane z(x,y) = dzdx*x + dzdy*y + zc, to get a lower bound of the depth of the triangle inside each tile
+		double dzdx = 0, dzdy = 0, zc = 0;
+		float zmin = std::min(z0, std::min(z1, z2));
+		if (depth)
+		{
+			double inv = 1.0 / (double)(area * sign);
+			dzdx = (z0 * (double)A[0] + z1 * (double)A[1] + z2 * (double)A[2]) * inv;
+			dzdy = (z0 * (double)B[0] + z1 * (double)B[1] + z2 * (double)B[2]) * inv;
+			zc = (z0 * (double)C[0] + z1 * (double)C[1] + z2 * (double)C[2]) * inv;
+		}
+
+		const int T = RASTER_TILE_SIZE;
+		for (int ty = miny & ~(T - 1); ty <= maxy; ty += T)
+		{
+			for (int tx = minx & ~(T - 1); tx <= maxx; tx += T)
+			{
+				//trivial reject/accept using the tile corner that maximizes/minimizes every edge
+				bool inside = true;
+				bool outside = false;
+				for (int i = 0; i < 3; i++)
+				{
+					long long e = A[i] * tx + B[i] * ty + C[i] + bias[i];
+					long long emax = e + (A[i] > 0 ? A[i] : 0) * (T - 1) + (B[i] > 0 ? B[i] : 0) * (T - 1);
+					long long emin = e + (A[i] < 0 ? A[i] : 0) * (T - 1) + (B[i] < 0 ? B[i] : 0) * (T - 1);
+					if (emax < 0) { outside = true; break; }
+					if (emin < 0) inside = false;
+				}
+				if (outside)
+					continue;
+
+				if (depth)
+				{
+					//the plane takes its minimum at a tile corner, but outside the triangle it can go below any vertex.
+					//RASTER_HIZ_EPSILON leaves room for the float rounding of the depth interpolated at every pixel
+					double zt = zc + dzdx * tx + dzdy * ty + std::min(dzdx, 0.0) * (T - 1) + std::min(dzdy, 0.0) * (T - 1);
+					if (std::max((double)zmin, zt) - RASTER_HIZ_EPSILON >= depth->getTileMax(tx / T, ty / T))
+						continue; //hidden: every pixel of the tile is already closer
+				}
+
+				int sx = std::max(tx, minx), ex = std::min(tx + T - 1, maxx);
+				int sy = std::max(ty, miny), ey = std::min(ty + T - 1, maxy);
+
+				//walk the tile incrementally, one add per edge and pixel
+				long long row0 = A[0] * sx + B[0] * sy + C[0] + bias[0];
+				long long row1 = A[1] * sx + B[1] * sy + C[1] + bias[1];
+				long long row2 = A[2] * sx + B[2] * sy + C[2] + bias[2];
+				for (int y = sy; y <= ey; y++)
+				{
+					long long e0 = row0, e1 = row1, e2 = row2;
+					for (int x = sx; x <= ex; x++)
+					{
+						if (inside || (e0 | e1 | e2) >= 0)
+							callback(x, y, (e0 - bias[0]) * inv_area, (e1 - bias[1]) * inv_area, (e2 - bias[2]) * inv_area);
+						e0 += A[0]; e1 += A[1]; e2 += A[2];
+					}
+					row0 += B[0]; row1 += B[1]; row2 += B[2];
+				}
+
+				if (depth)
+					depth->updateTile(tx / T, ty / T);
+			}
+		}
+	}
+
+	//false if rasterizeTriangle would not fill any pixel of the triangle: it has zero area, or its bounding box is at most
+	//RASTER_SUBPIXEL_BOX pixels wide and high and no pixel center there is inside (same edges and fill rule). Bigger ones are taken as covering something
+	static bool coversPixel(int x0, int y0, int x1, int y1, int x2, int y2);
+
 	void paint_pixel(int x, int y, Color c);
 	void DDA(int x0, int y0, int x1, int y1, Color color);
 	void drawLineBresenham(int x0, int y0, int x1, int y1, Color c);
 	void bresenhamCircle(int center_x, int center_y, int rad, Color c, bool fill);
 	int sgn(float n);
-	void init_table();
-	void breshenhamTable(int x0, int y0, int x1, int y1, Color c, std::vector<sCelda>& table);
-	void drawTriangle(int x0, int y0, int x1, int y1, int x2, int y2, Color c, bool fill);
+	void drawTriangle(int x0, int y0, int x1, int y1, int x2, int y2, Color c, bool fill, const ScreenRect* clip = NULL);
 	Vector3 reflect(Vector3 i, Vector3 n);
-	void drawTriangleInterpolated(int x0, int y0, int x1, int y1, int x2, int y2, float z1, float z2, float z3, FloatImage* zbuffer, Vector2 tex1, Vector2 tex2, Vector2 tex3, Image* texture);
-	void drawTriangleInterpolated_color(int x0, int y0, int x1, int y1, int x2, int y2, float z1, float z2, float z3, FloatImage* zbuffer, Color c0, Color c1, Color c2);
-	void PhongIlluminationTexture(int x0, int y0, int x1, int y1, int x2, int y2, float z0, float z1, float z2, FloatImage* zbuffer, Material* material, Light* light, Vector3 cam_pos, Vector2 tex1, Vector2 tex2, Vector2 tex3, Image* texture, Image* texture_normal);
+	void drawTriangleInterpolated(int x0, int y0, int x1, int y1, int x2, int y2, float z1, float z2, float z3, DepthBuffer* zbuffer, Vector2 tex1, Vector2 tex2, Vector2 tex3, Image* texture, const ScreenRect* clip = NULL);
+	void drawTriangleInterpolated_color(int x0, int y0, int x1, int y1, int x2, int y2, float z1, float z2, float z3, DepthBuffer* zbuffer, Color c0, Color c1, Color c2, const ScreenRect* clip = NULL);
+	void PhongIlluminationTexture(int x0, int y0, int x1, int y1, int x2, int y2, float z0, float z1, float z2, DepthBuffer* zbuffer, Material* material, Light* light, Vector3 cam_pos, Vector2 tex1, Vector2 tex2, Vector2 tex3, Image* texture, Image* texture_normal, const ScreenRect* clip = NULL);
+	void PhongIlluminationTexture_scalar(int x0, int y0, int x1, int y1, int x2, int y2, float z0, float z1, float z2, DepthBuffer* zbuffer, Material* material, Light* light, Vector3 cam_pos, Vector2 tex1, Vector2 tex2, Vector2 tex3, Image* texture, Image* texture_normal, const ScreenRect* clip = NULL);
+	void PhongIlluminationTexture_avx2(int x0, int y0, int x1, int y1, int x2, int y2, float z0, float z1, float z2, DepthBuffer* zbuffer, Material* material, Light* light, Vector3 cam_pos, Vector2 tex1, Vector2 tex2, Vector2 tex3, Image* texture, Image* texture_normal, const ScreenRect* clip = NULL); //8 pixels at a time, see image_avx2.cpp
+	Color PhongIlluminationPixel(int x, int y, float z, float tex_x, float tex_y, Material* material, Light* light, Vector3 cam_pos, Image* texture, Image* texture_normal);
+	void drawTriangleGBuffer(int x0, int y0, int x1, int y1, int x2, int y2, float z0, float z1, float z2, DepthBuffer* zbuffer, Vector2 tex1, Vector2 tex2, Vector2 tex3, GBuffer* gbuffer, int id, const ScreenRect* clip = NULL);
+	void PhongIlluminationGBuffer(DepthBuffer* zbuffer, GBuffer* gbuffer, Material* material, Light* light, Vector3 cam_pos, Image* texture, Image* texture_normal, const ScreenRect& rect);
+	void PhongIlluminationGBuffer_scalar(DepthBuffer* zbuffer, GBuffer* gbuffer, Material* material, Light* light, Vector3 cam_pos, Image* texture, Image* texture_normal, const ScreenRect& rect);
+	void PhongIlluminationGBuffer_avx2(DepthBuffer* zbuffer, GBuffer* gbuffer, Material* material, Light* light, Vector3 cam_pos, Image* texture, Image* texture_normal, const ScreenRect& rect); //see image_avx2.cpp
 	void setPixel_zbuffer(int x, int y, float z, FloatImage* zbuffer);
 	float getPixel_zbuffer(int x, int y, FloatImage* zbuffer);
 	Color getPixel_text(int x, int y, Image* texture);
@@ -113,34 +323,6 @@ public:
 
 };
 
-//Image that stores one float per pixel instead of a Color, like a matrix, useful for a Depth Buffer
-class FloatImage
-{
-public:
-	unsigned int width;
-	unsigned int height;
-	float* pixels;
-
-	// CONSTRUCTORS 
-	FloatImage() { width = height = 0; pixels = NULL; }
-	FloatImage(unsigned int width, unsigned int height);
-	FloatImage(const FloatImage& c);
-	FloatImage& operator = (const FloatImage& c); //assign operator
-
-	//destructor
-	~FloatImage();
-
-	void fill(const float& v) { for(unsigned int pos = 0; pos < width*height; ++pos) pixels[pos] = v; }
-
-	//get the pixel at position x,y
-	float getPixel(unsigned int x, unsigned int y) const { return pixels[y * width + x]; }
-	float& getPixelRef(unsigned int x, unsigned int y) { return pixels[y * width + x]; }
-
-	//set the pixel at position x,y with value C
-	inline void setPixel(unsigned int x, unsigned int y, const float& v) { pixels[y * width + x] = v; }
-
-	void resize(unsigned int width, unsigned int height);
-};
 
 
 
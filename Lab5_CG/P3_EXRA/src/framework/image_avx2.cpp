@@ -0,0 +1,346 @@
+/*  AVX2 version of Image::PhongIlluminationTexture: it rasterizes and shades one row of a tile (8 pixels) at a time.
+	The lighting pass of the deferred mode (Image::PhongIlluminationGBuffer) uses the same shading code.
+	It is only called when Image::simd_shading is set, so this file can be built without enabling AVX2 for the whole project.
+	The results match the scalar path within a couple of color levels (pow uses a polynomial exp2/log2 approximation).
+*/
+
+#include "image.h"
+#include "light.h"
+#include "material.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+
+#include <immintrin.h>
+
+//MSVC lets us use the intrinsics without any flag, gcc and clang need to be told per function
+#ifdef _MSC_VER
+	#define AVX2_FUNCTION
+#else
+	#define AVX2_FUNCTION __attribute__((target("avx2")))
+#endif
+
+//log2(x) for x > 0 using the cephes logf polynomial on the mantissa
+AVX2_FUNCTION static inline __m256 log2_avx2(__m256 x)
+{
+	const __m256 one = _mm256_set1_ps(1.0f);
+	__m256i bits = _mm256_castps_si256(x);
+	__m256 e = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(127)));
+	__m256 m = _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x007FFFFF)), _mm256_set1_epi32(0x3F800000)));
+
+	//move the mantissa to [sqrt(0.5), sqrt(2)) so the polynomial stays accurate
+	__m256 big = _mm256_cmp_ps(m, _mm256_set1_ps(1.41421356f), _CMP_GT_OQ);
+	m = _mm256_blendv_ps(m, _mm256_mul_ps(m, _mm256_set1_ps(0.5f)), big);
+	e = _mm256_add_ps(e, _mm256_and_ps(big, one));
+
+	__m256 f = _mm256_sub_ps(m, one);
+	__m256 z = _mm256_mul_ps(f, f);
+	__m256 p = _mm256_set1_ps(7.0376836292E-2f);
+	p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(-1.1514610310E-1f));
+	p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(1.1676998740E-1f));
+	p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(-1.2420140846E-1f));
+	p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(1.4249322787E-1f));
+	p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(-1.6668057665E-1f));
+	p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(2.0000714765E-1f));
+	p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(-2.4999993993E-1f));
+	p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(3.3333331174E-1f));
+	p = _mm256_mul_ps(_mm256_mul_ps(p, f), z);
+	__m256 ln = _mm256_add_ps(f, _mm256_sub_ps(p, _mm256_mul_ps(z, _mm256_set1_ps(0.5f))));
+
+	return _mm256_add_ps(e, _mm256_mul_ps(ln, _mm256_set1_ps(1.44269504089f)));
+}
+
+//2^x using the cephes exp2f polynomial, values under -126 return 0
+AVX2_FUNCTION static inline __m256 exp2_avx2(__m256 x)
+{
+	__m256 underflow = _mm256_cmp_ps(x, _mm256_set1_ps(-126.0f), _CMP_LT_OQ);
+	x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-126.0f)), _mm256_set1_ps(127.0f));
+
+	//split in integer part and a fraction in [-0.5, 0.5]
+	__m256 i = _mm256_round_ps(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	__m256 f = _mm256_sub_ps(x, i);
+
+	__m256 p = _mm256_set1_ps(1.535336188319500E-4f);
+	p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(1.339887440266574E-3f));
+	p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(9.618437357674640E-3f));
+	p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(5.550332471162809E-2f));
+	p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(2.402264791363012E-1f));
+	p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(6.931472028550421E-1f));
+	p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(1.0f));
+
+	//multiply by 2^i adding i to the exponent bits
+	__m256i exponent = _mm256_slli_epi32(_mm256_cvtps_epi32(i), 23);
+	__m256 result = _mm256_castsi256_ps(_mm256_add_epi32(_mm256_castps_si256(p), exponent));
+	return _mm256_andnot_ps(underflow, result);
+}
+
+//x^y for x >= 0, like pow: 0^y is 0 unless y is 0
+AVX2_FUNCTION static inline __m256 pow_avx2(__m256 x, float y)
+{
+	__m256 zero = _mm256_setzero_ps();
+	__m256 is_zero = _mm256_cmp_ps(x, zero, _CMP_LE_OQ);
+	__m256 safe_x = _mm256_blendv_ps(x, _mm256_set1_ps(1.0f), is_zero);
+	__m256 result = exp2_avx2(_mm256_mul_ps(log2_avx2(safe_x), _mm256_set1_ps(y)));
+	return _mm256_blendv_ps(result, _mm256_set1_ps(y == 0.0f ? 1.0f : 0.0f), is_zero);
+}
+
+//reads the Color (3 bytes) of every lane. The 4 bytes gathered start one byte before the color (except for the first one)
+//so we never read past the end of the pixels
+AVX2_FUNCTION static inline void gatherColor_avx2(const Image* texture, __m256i index, __m256i mask, __m256& r, __m256& g, __m256& b)
+{
+	__m256i not_first = _mm256_cmpgt_epi32(index, _mm256_setzero_si256());
+	__m256i offset = _mm256_add_epi32(_mm256_mullo_epi32(index, _mm256_set1_epi32(3)), not_first);
+	__m256i shift = _mm256_and_si256(not_first, _mm256_set1_epi32(8));
+
+	__m256i value = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), (const int*)texture->pixels, offset, mask, 1);
+	value = _mm256_srlv_epi32(value, shift);
+
+	__m256i byte = _mm256_set1_epi32(0xFF);
+	__m256 inv_255 = _mm256_set1_ps(255.0f);
+	r = _mm256_div_ps(_mm256_cvtepi32_ps(_mm256_and_si256(value, byte)), inv_255);
+	g = _mm256_div_ps(_mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(value, 8), byte)), inv_255);
+	b = _mm256_div_ps(_mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(value, 16), byte)), inv_255);
+}
+
+//texel index of every lane for the interpolated uvs, same rounding as the scalar path but clamped to the texture
+AVX2_FUNCTION static inline __m256i texelIndex_avx2(const Image* texture, __m256 tu, __m256 tv)
+{
+	__m256i tx = _mm256_cvttps_epi32(_mm256_mul_ps(tu, _mm256_set1_ps((float)(texture->width - 1))));
+	__m256i ty = _mm256_cvttps_epi32(_mm256_mul_ps(tv, _mm256_set1_ps((float)(texture->height - 1))));
+	tx = _mm256_min_epi32(_mm256_max_epi32(tx, _mm256_setzero_si256()), _mm256_set1_epi32(texture->width - 1));
+	ty = _mm256_min_epi32(_mm256_max_epi32(ty, _mm256_setzero_si256()), _mm256_set1_epi32(texture->height - 1));
+	return _mm256_add_epi32(_mm256_mullo_epi32(ty, _mm256_set1_epi32(texture->width)), tx);
+}
+
+AVX2_FUNCTION static inline __m256 dot_avx2(__m256 ax, __m256 ay, __m256 az, __m256 bx, __m256 by, __m256 bz)
+{
+	return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ax, bx), _mm256_mul_ps(ay, by)), _mm256_mul_ps(az, bz));
+}
+
+AVX2_FUNCTION static inline void normalize_avx2(__m256& x, __m256& y, __m256& z)
+{
+	__m256 len = _mm256_sqrt_ps(dot_avx2(x, y, z, x, y, z));
+	x = _mm256_div_ps(x, len);
+	y = _mm256_div_ps(y, len);
+	z = _mm256_div_ps(z, len);
+}
+
+//textured phong of 8 consecutive pixels starting at row (only the ones set in mask are written), same math as Image::PhongIlluminationPixel
+AVX2_FUNCTION static inline void shadePhong_avx2(Color* row, __m256i mask, __m256 fx, __m256 fy, __m256 z, __m256 tu, __m256 tv, const Material* material, const Light* light, const Vector3& cam_pos, const Image* texture, const Image* texture_normal)
+{
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 two = _mm256_set1_ps(2.0f);
+
+	Vector3 kd(material->diffuse.x * light->diffuse_color.x, material->diffuse.y * light->diffuse_color.y, material->diffuse.z * light->diffuse_color.z);
+	Vector3 ks(material->specular.x * light->specular_color.x, material->specular.y * light->specular_color.y, material->specular.z * light->specular_color.z);
+	Vector3 ka(material->ambient.x * 0.1f, material->ambient.y * 0.1f, material->ambient.z * 0.1f);
+
+	__m256 c1_r, c1_g, c1_b, nx, ny, nz;
+	gatherColor_avx2(texture, texelIndex_avx2(texture, tu, tv), mask, c1_r, c1_g, c1_b);
+	gatherColor_avx2(texture_normal, texelIndex_avx2(texture_normal, tu, tv), mask, nx, ny, nz);
+	normalize_avx2(nx, ny, nz);
+
+	//phong
+	__m256 lx = _mm256_sub_ps(_mm256_set1_ps(light->position.x), fx);
+	__m256 ly = _mm256_sub_ps(_mm256_set1_ps(light->position.y), fy);
+	__m256 lz = _mm256_sub_ps(_mm256_set1_ps(light->position.z), z);
+	normalize_avx2(lx, ly, lz);
+
+	__m256 vx = _mm256_sub_ps(_mm256_set1_ps(cam_pos.x), fx);
+	__m256 vy = _mm256_sub_ps(_mm256_set1_ps(cam_pos.y), fy);
+	__m256 vz = _mm256_sub_ps(_mm256_set1_ps(cam_pos.z), z);
+	normalize_avx2(vx, vy, vz);
+
+	__m256 LdotN = dot_avx2(lx, ly, lz, nx, ny, nz);
+	__m256 k = _mm256_mul_ps(two, _mm256_min_ps(_mm256_max_ps(LdotN, zero), one));
+	__m256 rx = _mm256_sub_ps(_mm256_mul_ps(nx, k), lx);
+	__m256 ry = _mm256_sub_ps(_mm256_mul_ps(ny, k), ly);
+	__m256 rz = _mm256_sub_ps(_mm256_mul_ps(nz, k), lz);
+	normalize_avx2(rx, ry, rz);
+
+	__m256 diffuse = _mm256_min_ps(_mm256_max_ps(_mm256_sub_ps(zero, LdotN), zero), one);
+	__m256 specular = pow_avx2(_mm256_max_ps(dot_avx2(rx, ry, rz, vx, vy, vz), zero), material->shininess);
+
+	//Ip = c1 * (kd * diffuse + ks * specular + ka)
+	__m256 scale = _mm256_set1_ps(255.0f);
+	__m256 ip_r = _mm256_mul_ps(c1_r, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(kd.x), diffuse), _mm256_mul_ps(_mm256_set1_ps(ks.x), specular)), _mm256_set1_ps(ka.x)));
+	__m256 ip_g = _mm256_mul_ps(c1_g, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(kd.y), diffuse), _mm256_mul_ps(_mm256_set1_ps(ks.y), specular)), _mm256_set1_ps(ka.y)));
+	__m256 ip_b = _mm256_mul_ps(c1_b, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(kd.z), diffuse), _mm256_mul_ps(_mm256_set1_ps(ks.z), specular)), _mm256_set1_ps(ka.z)));
+
+	//same conversion as Color(float, float, float): truncate to int and keep the low byte
+	int out_r[8], out_g[8], out_b[8];
+	_mm256_storeu_si256((__m256i*)out_r, _mm256_cvttps_epi32(_mm256_mul_ps(ip_r, scale)));
+	_mm256_storeu_si256((__m256i*)out_g, _mm256_cvttps_epi32(_mm256_mul_ps(ip_g, scale)));
+	_mm256_storeu_si256((__m256i*)out_b, _mm256_cvttps_epi32(_mm256_mul_ps(ip_b, scale)));
+
+	int bits = _mm256_movemask_ps(_mm256_castsi256_ps(mask));
+	for (int i = 0; i < 8; i++)
+	{
+		if (bits & (1 << i))
+		{
+			row[i].r = (unsigned char)out_r[i];
+			row[i].g = (unsigned char)out_g[i];
+			row[i].b = (unsigned char)out_b[i];
+		}
+	}
+}
+
+AVX2_FUNCTION void Image::PhongIlluminationTexture_avx2(int x0, int y0, int x1, int y1, int x2, int y2, float z0, float z1, float z2, DepthBuffer* zbuffer, Material* material, Light* light, Vector3 cam_pos, Vector2 tex1, Vector2 tex2, Vector2 tex3, Image* texture, Image* texture_normal, const ScreenRect* clip) {
+	long long area = (long long)(x1 - x0) * (y2 - y0) - (long long)(y1 - y0) * (x2 - x0);
+	if (area == 0 || width == 0 || height == 0)
+		return;
+
+	//bounding box, same as rasterizeTriangle
+	int minx = std::max(std::min(x0, std::min(x1, x2)), 0);
+	int miny = std::max(std::min(y0, std::min(y1, y2)), 0);
+	int maxx = std::min(std::max(x0, std::max(x1, x2)), (int)width - 1);
+	int maxy = std::min(std::max(y0, std::max(y1, y2)), (int)height - 1);
+	if (clip)
+	{
+		minx = std::max(minx, clip->minx); miny = std::max(miny, clip->miny);
+		maxx = std::min(maxx, clip->maxx); maxy = std::min(maxy, clip->maxy);
+	}
+	if (minx > maxx || miny > maxy)
+		return;
+
+	//edge functions, the vertices are inside SIMD_MAX_COORD so every value fits in 32 bits
+	int vx[3] = { x0, x1, x2 };
+	int vy[3] = { y0, y1, y2 };
+	int sign = area > 0 ? 1 : -1;
+	int A[3], B[3], C[3], bias[3];
+	for (int i = 0; i < 3; i++)
+	{
+		int a = (i + 1) % 3, b = (i + 2) % 3;
+		A[i] = sign * (vy[a] - vy[b]);
+		B[i] = sign * (vx[b] - vx[a]);
+		C[i] = -(A[i] * vx[a] + B[i] * vy[a]);
+		bias[i] = (A[i] > 0 || (A[i] == 0 && B[i] > 0)) ? 0 : -1;
+	}
+	__m256 inv_area = _mm256_set1_ps(1.0f / (float)(area * sign));
+
+	//depth plane for the hierarchical z test, same as rasterizeTriangle
+	double inv = 1.0 / (double)(area * sign);
+	double dzdx = (z0 * (double)A[0] + z1 * (double)A[1] + z2 * (double)A[2]) * inv;
+	double dzdy = (z0 * (double)B[0] + z1 * (double)B[1] + z2 * (double)B[2]) * inv;
+	double zc = (z0 * (double)C[0] + z1 * (double)C[1] + z2 * (double)C[2]) * inv;
+	float zmin = std::min(z0, std::min(z1, z2));
+
+	//values that are the same for every pixel
+	const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	__m256i step[3], vbias[3];
+	for (int i = 0; i < 3; i++)
+	{
+		step[i] = _mm256_mullo_epi32(lane, _mm256_set1_epi32(A[i]));
+		vbias[i] = _mm256_set1_epi32(bias[i]);
+	}
+	__m256i lane_min = _mm256_set1_epi32(minx - 1);
+	__m256i lane_max = _mm256_set1_epi32(maxx + 1);
+
+	const int T = RASTER_TILE_SIZE;
+	for (int ty = miny & ~(T - 1); ty <= maxy; ty += T)
+	{
+		for (int tx = minx & ~(T - 1); tx <= maxx; tx += T)
+		{
+			//trivial reject/accept of the whole tile
+			bool inside = true;
+			bool outside = false;
+			for (int i = 0; i < 3; i++)
+			{
+				long long e = (long long)A[i] * tx + (long long)B[i] * ty + C[i] + bias[i];
+				long long emax = e + (A[i] > 0 ? A[i] : 0) * (T - 1) + (B[i] > 0 ? B[i] : 0) * (T - 1);
+				long long emin = e + (A[i] < 0 ? A[i] : 0) * (T - 1) + (B[i] < 0 ? B[i] : 0) * (T - 1);
+				if (emax < 0) { outside = true; break; }
+				if (emin < 0) inside = false;
+			}
+			if (outside)
+				continue;
+
+			double zt = zc + dzdx * tx + dzdy * ty + std::min(dzdx, 0.0) * (T - 1) + std::min(dzdy, 0.0) * (T - 1);
+			if (std::max((double)zmin, zt) - RASTER_HIZ_EPSILON >= zbuffer->getTileMax(tx / T, ty / T))
+				continue;
+
+			__m256i xs = _mm256_add_epi32(_mm256_set1_epi32(tx), lane);
+			__m256i row_mask = _mm256_and_si256(_mm256_cmpgt_epi32(xs, lane_min), _mm256_cmpgt_epi32(lane_max, xs));
+			__m256 fx = _mm256_cvtepi32_ps(xs);
+
+			int sy = std::max(ty, miny), ey = std::min(ty + T - 1, maxy);
+			for (int y = sy; y <= ey; y++)
+			{
+				__m256i e0 = _mm256_add_epi32(_mm256_set1_epi32(A[0] * tx + B[0] * y + C[0] + bias[0]), step[0]);
+				__m256i e1 = _mm256_add_epi32(_mm256_set1_epi32(A[1] * tx + B[1] * y + C[1] + bias[1]), step[1]);
+				__m256i e2 = _mm256_add_epi32(_mm256_set1_epi32(A[2] * tx + B[2] * y + C[2] + bias[2]), step[2]);
+
+				__m256i mask = row_mask;
+				if (!inside)
+					mask = _mm256_and_si256(mask, _mm256_cmpgt_epi32(_mm256_or_si256(e0, _mm256_or_si256(e1, e2)), _mm256_set1_epi32(-1)));
+				if (_mm256_testz_si256(mask, mask))
+					continue;
+
+				//barycentric weights
+				__m256 u = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_sub_epi32(e0, vbias[0])), inv_area);
+				__m256 v = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_sub_epi32(e1, vbias[1])), inv_area);
+				__m256 w = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_sub_epi32(e2, vbias[2])), inv_area);
+
+				//depth test
+				float* depth = zbuffer->pixels + y * zbuffer->width + tx;
+				__m256 z = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(z0), u), _mm256_mul_ps(_mm256_set1_ps(z1), v)), _mm256_mul_ps(_mm256_set1_ps(z2), w));
+				__m256 z_2 = _mm256_maskload_ps(depth, mask);
+				mask = _mm256_and_si256(mask, _mm256_castps_si256(_mm256_cmp_ps(z, z_2, _CMP_LT_OQ)));
+				if (_mm256_testz_si256(mask, mask))
+					continue;
+				_mm256_maskstore_ps(depth, mask, z);
+
+				//textures
+				__m256 tu = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(tex1.x), u), _mm256_mul_ps(_mm256_set1_ps(tex2.x), v)), _mm256_mul_ps(_mm256_set1_ps(tex3.x), w));
+				__m256 tv = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(tex1.y), u), _mm256_mul_ps(_mm256_set1_ps(tex2.y), v)), _mm256_mul_ps(_mm256_set1_ps(tex3.y), w));
+
+				shadePhong_avx2(pixels + y * width + tx, mask, fx, _mm256_set1_ps((float)y), z, tu, tv, material, light, cam_pos, texture, texture_normal);
+			}
+
+			zbuffer->updateTile(tx / T, ty / T);
+		}
+	}
+}
+
+//lighting pass of the deferred mode, 8 pixels of a row at a time
+AVX2_FUNCTION void Image::PhongIlluminationGBuffer_avx2(DepthBuffer* zbuffer, GBuffer* gbuffer, Material* material, Light* light, Vector3 cam_pos, Image* texture, Image* texture_normal, const ScreenRect& rect) {
+	const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	const __m256i uv_index = _mm256_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14); //uvs are stored as x,y pairs
+	__m256i lane_max = _mm256_set1_epi32(rect.maxx + 1);
+
+	for (int y = rect.miny; y <= rect.maxy; y++)
+	{
+		__m256 fy = _mm256_set1_ps((float)y);
+		for (int x = rect.minx; x <= rect.maxx; x += 8)
+		{
+			__m256i xs = _mm256_add_epi32(_mm256_set1_epi32(x), lane);
+			__m256i mask = _mm256_cmpgt_epi32(lane_max, xs);
+
+			int pos = y * gbuffer->width + x;
+			__m256i ids = _mm256_maskload_epi32(gbuffer->ids + pos, mask);
+			mask = _mm256_and_si256(mask, _mm256_cmpgt_epi32(ids, _mm256_set1_epi32(-1)));
+			if (_mm256_testz_si256(mask, mask))
+				continue; //background
+
+			const float* uvs = gbuffer->uvs[pos].value;
+			__m256 tu = _mm256_mask_i32gather_ps(_mm256_setzero_ps(), uvs, uv_index, _mm256_castsi256_ps(mask), 4);
+			__m256 tv = _mm256_mask_i32gather_ps(_mm256_setzero_ps(), uvs + 1, uv_index, _mm256_castsi256_ps(mask), 4);
+			__m256 z = _mm256_maskload_ps(zbuffer->pixels + y * zbuffer->width + x, mask);
+
+			shadePhong_avx2(pixels + y * width + x, mask, _mm256_cvtepi32_ps(xs), fy, z, tu, tv, material, light, cam_pos, texture, texture_normal);
+		}
+	}
+}
+
+#else
+
+//no AVX2 in this platform, simd_shading should never be set but just in case
+void Image::PhongIlluminationGBuffer_avx2(DepthBuffer* zbuffer, GBuffer* gbuffer, Material* material, Light* light, Vector3 cam_pos, Image* texture, Image* texture_normal, const ScreenRect& rect) {
+	PhongIlluminationGBuffer_scalar(zbuffer, gbuffer, material, light, cam_pos, texture, texture_normal, rect);
+}
+
+void Image::PhongIlluminationTexture_avx2(int x0, int y0, int x1, int y1, int x2, int y2, float z0, float z1, float z2, DepthBuffer* zbuffer, Material* material, Light* light, Vector3 cam_pos, Vector2 tex1, Vector2 tex2, Vector2 tex3, Image* texture, Image* texture_normal, const ScreenRect* clip) {
+	PhongIlluminationTexture_scalar(x0, y0, x1, y1, x2, y2, z0, z1, z2, zbuffer, material, light, cam_pos, tex1, tex2, tex3, texture, texture_normal, clip);
+}
+
+#endif
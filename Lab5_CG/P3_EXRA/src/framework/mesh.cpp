@@ -3,17 +3,19 @@
 #include "includes.h"
 #include "camera.h"
 
+#include <cmath>
+#include <thread>
+#include <functional>
+#include <algorithm>
+#include "mappedfile.h"
+
 #include <string>
 #include <sys/stat.h>
 
 
-std::vector<std::string> tokenize(const std::string& source, const char* delimiters, bool process_strings = false);
-Vector2 parseVector2(const char* text);
-Vector3 parseVector3(const char* text, const char separator);
-
-
 Mesh::Mesh()
 {
+	num_stream_vertices = 0;
 }
 
 void Mesh::clear()
@@ -21,6 +23,180 @@ void Mesh::clear()
 	vertices.clear();
 	normals.clear();
 	uvs.clear();
+	indices.clear();
+	releaseStreams();
+	computeBounds();
+}
+
+//copies one component of the values to the stream, padded with the last one
+static void fillStream(FloatStream& stream, const std::vector<Vector3>& values, int component)
+{
+	size_t padded = (values.size() + MESH_STREAM_PADDING - 1) / MESH_STREAM_PADDING * MESH_STREAM_PADDING;
+	stream.resize(padded);
+	for (size_t i = 0; i < values.size(); i++)
+		stream[i] = values[i].v[component];
+	for (size_t i = values.size(); i < padded; i++)
+		stream[i] = values.back().v[component];
+}
+
+void Mesh::updateStreams()
+{
+	releaseStreams();
+	if (vertices.empty())
+		return;
+
+	for (int k = 0; k < 3; k++)
+		fillStream(position_stream[k], vertices, k);
+	num_stream_vertices = vertices.size();
+	computeBounds();
+}
+
+void Mesh::releaseStreams()
+{
+	for (int k = 0; k < 3; k++)
+		position_stream[k].clear();
+	num_stream_vertices = 0;
+}
+
+void Mesh::computeBounds()
+{
+	if (vertices.empty())
+	{
+		aabb_min = aabb_max = Vector3();
+		return;
+	}
+
+#ifdef FRAMEWORK_SSE
+	if (hasStreams())
+	{
+		//the padding repeats the last vertex, so it does not change the result
+		size_t padded = position_stream[0].size();
+		for (int k = 0; k < 3; k++)
+		{
+			const float* stream = &position_stream[k][0];
+			__m128 low = _mm_load_ps(stream);
+			__m128 high = low;
+			for (size_t i = 4; i < padded; i += 4)
+			{
+				__m128 value = _mm_load_ps(stream + i);
+				low = _mm_min_ps(low, value);
+				high = _mm_max_ps(high, value);
+			}
+			float l[4], h[4];
+			_mm_storeu_ps(l, low);
+			_mm_storeu_ps(h, high);
+			aabb_min.v[k] = std::min(std::min(l[0], l[1]), std::min(l[2], l[3]));
+			aabb_max.v[k] = std::max(std::max(h[0], h[1]), std::max(h[2], h[3]));
+		}
+		return;
+	}
+#endif
+
+	aabb_min = aabb_max = vertices[0];
+	for (size_t i = 1; i < vertices.size(); i++)
+		for (int k = 0; k < 3; k++)
+		{
+			aabb_min.v[k] = std::min(aabb_min.v[k], vertices[i].v[k]);
+			aabb_max.v[k] = std::max(aabb_max.v[k], vertices[i].v[k]);
+		}
+}
+
+void Mesh::computeNormals()
+{
+	int num_vertices = vertices.size();
+	if (num_vertices == 0)
+		return;
+	bool streams = hasStreams();
+
+	//the sums are kept as structure of arrays with the padding of the streams, so they are normalized 4 at a time
+	size_t padded = (num_vertices + MESH_STREAM_PADDING - 1) / MESH_STREAM_PADDING * MESH_STREAM_PADDING;
+	FloatStream sum[3];
+	for (int k = 0; k < 3; k++)
+		sum[k].assign(padded, 0.0f);
+
+	int num_triangles = (indices.size() ? indices.size() : num_vertices) / 3;
+	int t = 0;
+#ifdef FRAMEWORK_SSE
+	//the normals of 4 triangles at a time, with the same operations as the loop below so both give the same result.
+	//The sums stay scalar: the triangles share vertices, so they can not be added in parallel
+	for (; t + 4 <= num_triangles; t += 4)
+	{
+		unsigned int corner[4][3];
+		__m128 p[3][3];
+		for (int c = 0; c < 3; c++)
+		{
+			for (int j = 0; j < 4; j++)
+				corner[j][c] = indices.size() ? indices[(t + j) * 3 + c] : (t + j) * 3 + c;
+			for (int k = 0; k < 3; k++)
+			{
+				float values[4];
+				for (int j = 0; j < 4; j++)
+					values[j] = streams ? position_stream[k][corner[j][c]] : vertices[corner[j][c]].v[k];
+				p[c][k] = _mm_loadu_ps(values);
+			}
+		}
+
+		__m128 e1[3], e2[3];
+		for (int k = 0; k < 3; k++)
+		{
+			e1[k] = _mm_sub_ps(p[1][k], p[0][k]);
+			e2[k] = _mm_sub_ps(p[2][k], p[0][k]);
+		}
+		float n[3][4];
+		_mm_storeu_ps(n[0], _mm_sub_ps(_mm_mul_ps(e1[1], e2[2]), _mm_mul_ps(e1[2], e2[1])));
+		_mm_storeu_ps(n[1], _mm_sub_ps(_mm_mul_ps(e1[2], e2[0]), _mm_mul_ps(e1[0], e2[2])));
+		_mm_storeu_ps(n[2], _mm_sub_ps(_mm_mul_ps(e1[0], e2[1]), _mm_mul_ps(e1[1], e2[0])));
+
+		for (int j = 0; j < 4; j++)
+			for (int c = 0; c < 3; c++)
+				for (int k = 0; k < 3; k++)
+					sum[k][corner[j][c]] += n[k][j];
+	}
+#endif
+	for (; t < num_triangles; t++)
+	{
+		unsigned int corner[3];
+		float p[3][3];
+		for (int c = 0; c < 3; c++)
+		{
+			corner[c] = indices.size() ? indices[t * 3 + c] : t * 3 + c;
+			for (int k = 0; k < 3; k++)
+				p[c][k] = streams ? position_stream[k][corner[c]] : vertices[corner[c]].v[k];
+		}
+
+		//cross product of two edges, its length is twice the area of the triangle
+		float e1[3] = { p[1][0] - p[0][0], p[1][1] - p[0][1], p[1][2] - p[0][2] };
+		float e2[3] = { p[2][0] - p[0][0], p[2][1] - p[0][1], p[2][2] - p[0][2] };
+		float n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+		for (int c = 0; c < 3; c++)
+			for (int k = 0; k < 3; k++)
+				sum[k][corner[c]] += n[k];
+	}
+
+	size_t i = 0;
+#ifdef FRAMEWORK_SSE
+	const __m128 tiny = _mm_set1_ps(1e-30f); //vertices without triangles keep a zero normal instead of a NaN
+	for (; i < padded; i += 4)
+	{
+		__m128 x = _mm_load_ps(&sum[0][i]);
+		__m128 y = _mm_load_ps(&sum[1][i]);
+		__m128 z = _mm_load_ps(&sum[2][i]);
+		__m128 length = _mm_max_ps(_mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z))), tiny);
+		_mm_store_ps(&sum[0][i], _mm_div_ps(x, length));
+		_mm_store_ps(&sum[1][i], _mm_div_ps(y, length));
+		_mm_store_ps(&sum[2][i], _mm_div_ps(z, length));
+	}
+#endif
+	for (; i < (size_t)num_vertices; i++)
+	{
+		float length = std::max(std::sqrt(sum[0][i] * sum[0][i] + sum[1][i] * sum[1][i] + sum[2][i] * sum[2][i]), 1e-30f);
+		for (int k = 0; k < 3; k++)
+			sum[k][i] /= length;
+	}
+
+	normals.resize(num_vertices);
+	for (int v = 0; v < num_vertices; v++)
+		normals[v] = Vector3(sum[0][v], sum[1][v], sum[2][v]);
 }
 
 void Mesh::render( Camera* camera, Image* framebuffer )
@@ -31,9 +207,7 @@ void Mesh::render( Camera* camera, Image* framebuffer )
 
 void Mesh::createPlane(float size)
 {
-	vertices.clear();
-	normals.clear();
-	uvs.clear();
+	clear();
 
 	//create six vertices (3 for upperleft triangle and 3 for lowerright)
 
@@ -59,237 +233,734 @@ void Mesh::createPlane(float size)
 	uvs.push_back( Vector2(0,1) );
 	uvs.push_back( Vector2(1,1) );
 	uvs.push_back( Vector2(0,0) );
+
+	computeBounds();
 }
 
 
-bool Mesh::loadOBJ(const char* filename)
+//OBJ parsing helpers: they work in place over the mapped file, so they never go past end and need no null terminator
+
+static inline const char* skipSpaces(const char* pos, const char* end)
 {
-	struct stat stbuffer;
-	std::cout << "Loading mesh: " << filename << std::endl;
+	while (pos < end && (*pos == ' ' || *pos == '\t' || *pos == '\r'))
+		pos++;
+	return pos;
+}
 
-	FILE* f = fopen(filename,"rb");
-	if (f == NULL)
+static inline const char* nextLine(const char* pos, const char* end)
+{
+	const char* eol = (const char*)memchr(pos, '\n', end - pos);
+	return eol ? eol + 1 : end;
+}
+
+//reads a decimal number like atof (sign, digits, fraction and exponent), returns where it stopped or NULL if there was no number
+static const char* parseFloat(const char* pos, const char* end, double& value)
+{
+	static const double powers_of_10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+	bool negative = false;
+	if (pos < end && (*pos == '-' || *pos == '+'))
+		negative = *pos++ == '-';
+
+	//keep up to 19 significant digits in an integer, the rest only move the exponent
+	unsigned long long mantissa = 0;
+	int digits = 0;
+	int exponent = 0;
+	bool any = false;
+	for (; pos < end && *pos >= '0' && *pos <= '9'; pos++)
 	{
-		std::cerr << "File not found: " << filename << std::endl;
-		return false;
+		any = true;
+		if (digits < 19) { mantissa = mantissa * 10 + (*pos - '0'); if (mantissa) digits++; }
+		else exponent++;
 	}
+	if (pos < end && *pos == '.')
+	{
+		for (pos++; pos < end && *pos >= '0' && *pos <= '9'; pos++)
+		{
+			any = true;
+			if (digits < 19) { mantissa = mantissa * 10 + (*pos - '0'); if (mantissa) digits++; exponent--; }
+		}
+	}
+	if (!any)
+		return NULL;
 
-	stat(filename,&stbuffer);
+	if (pos < end && (*pos == 'e' || *pos == 'E'))
+	{
+		const char* exp_pos = pos + 1;
+		bool exp_negative = false;
+		if (exp_pos < end && (*exp_pos == '-' || *exp_pos == '+'))
+			exp_negative = *exp_pos++ == '-';
+		if (exp_pos < end && *exp_pos >= '0' && *exp_pos <= '9')
+		{
+			int e = 0;
+			for (; exp_pos < end && *exp_pos >= '0' && *exp_pos <= '9'; exp_pos++)
+				if (e < 10000) e = e * 10 + (*exp_pos - '0');
+			exponent += exp_negative ? -e : e;
+			pos = exp_pos;
+		}
+	}
 
-	unsigned int size = stbuffer.st_size;
-	char* data = new char[size+1];
-	fread(data,size,1,f);
-	fclose(f);
-	data[size] = 0;
+	//dividing by an exact power of 10 gives the same rounding as atof for the usual short numbers
+	value = (double)mantissa;
+	if (exponent < 0)
+		value = -exponent <= 22 ? value / powers_of_10[-exponent] : value * pow(10.0, exponent);
+	else if (exponent > 0)
+		value = exponent <= 22 ? value * powers_of_10[exponent] : value * pow(10.0, exponent);
+	if (negative)
+		value = -value;
+	return pos;
+}
 
-	char* pos = data;
-	char line[255];
-	int i = 0;
+//reads an integer, returns where it stopped or NULL if there was no number
+static inline const char* parseInt(const char* pos, const char* end, long long& value)
+{
+	bool negative = false;
+	if (pos < end && (*pos == '-' || *pos == '+'))
+		negative = *pos++ == '-';
+	if (pos >= end || *pos < '0' || *pos > '9')
+		return NULL;
+	value = 0;
+	for (; pos < end && *pos >= '0' && *pos <= '9'; pos++)
+		value = value * 10 + (*pos - '0');
+	if (negative)
+		value = -value;
+	return pos;
+}
 
-	std::vector<Vector3> indexed_positions;
-	std::vector<Vector3> indexed_normals;
-	std::vector<Vector2> indexed_uvs;
+//reads one "v/vt/vn" corner of a face (vt and vn are optional), missing indices are left to 0
+static inline const char* parseFaceVertex(const char* pos, const char* end, long long* index)
+{
+	index[0] = index[1] = index[2] = 0;
+	pos = parseInt(pos, end, index[0]);
+	if (!pos)
+		return NULL;
+	for (int i = 1; i < 3 && pos < end && *pos == '/'; i++)
+	{
+		pos++;
+		if (pos < end && *pos != '/' && *pos != ' ' && *pos != '\t' && *pos != '\r' && *pos != '\n')
+		{
+			pos = parseInt(pos, end, index[i]);
+			if (!pos)
+				return NULL;
+		}
+	}
+	return pos;
+}
 
-	const float max_float = 10000000;
-	const float min_float = -10000000;
+//part of an OBJ file parsed by one thread, with everything it found.
+//The faces are kept as 3 indices (v, vt, vn) per triangle corner until every chunk knows where its elements start
+typedef struct sOBJChunk
+{
+	const char* start;
+	const char* end;
+	int lines;
+	int error_line; //0 if the chunk was parsed without problems
 
-	unsigned int vertex_i = 0;
+	std::vector<Vector3> positions;
+	std::vector<Vector3> normals;
+	std::vector<Vector2> uvs;
+	std::vector<long long> corners;
 
-	//parse file
-	while(*pos != 0)
-	{
-		if (*pos == '\n') pos++;
-		if (*pos == '\r') pos++;
+	//where the elements of this chunk go in the whole file (prefix sums of the previous chunks)
+	size_t first_position, first_normal, first_uv;
+} OBJChunk;
 
-		//read one line
-		i = 0;
-		while(i < 255 && pos[i] != '\n' && pos[i] != '\r' && pos[i] != 0) i++;
-		memcpy(line,pos,i);
-		line[i] = 0;
-		pos = pos + i;
+//negative OBJ indices count back from the last element read, but a chunk does not know how many elements the previous chunks have.
+//They are stored relative to the start of the chunk and tagged with this offset so they can be resolved later
+#define OBJ_RELATIVE_INDEX (1LL << 62)
 
-		//std::cout << "Line: \"" << line << "\"" << std::endl;
-		if (*line == '#' || *line == 0) continue; //comment
+//empty slot in the hash table used to find repeated vertices
+#define MESH_NO_VERTEX 0xFFFFFFFF
 
-		//tokenize line
-		std::vector<std::string> tokens = tokenize(line," ");
+//runs job(0) ... job(count-1) each one in its own thread (the first one in the calling thread)
+static void runInThreads(int count, const std::function<void(int)>& job)
+{
+	std::vector<std::thread> threads;
+	for (int i = 1; i < count; i++)
+		threads.push_back(std::thread(job, i));
+	job(0);
+	for (size_t i = 0; i < threads.size(); i++)
+		threads[i].join();
+}
 
-		if (tokens.empty()) continue;
+//parses the v, vt, vn and f lines of a chunk
+static void parseOBJChunk(OBJChunk& chunk)
+{
+	const char* end = chunk.end;
 
-		if (tokens[0] == "v" && tokens.size() == 4)
-		{
-			Vector3 v( atof(tokens[1].c_str()), atof(tokens[2].c_str()), atof(tokens[3].c_str()) );
-			indexed_positions.push_back(v);
-		}
-		else if (tokens[0] == "vt" && tokens.size() == 4)
-		{
-			Vector2 v( atof(tokens[1].c_str()), 1.0 - atof(tokens[2].c_str()) );
-			indexed_uvs.push_back(v);
-		}
-		else if (tokens[0] == "vn" && tokens.size() == 4)
+	//first pass: count the elements so every array is allocated only once
+	size_t num_positions = 0, num_uvs = 0, num_normals = 0, num_faces = 0;
+	for (const char* line = chunk.start; line < end; line = nextLine(line, end))
+	{
+		const char* pos = skipSpaces(line, end);
+		if (end - pos < 2)
+			continue;
+		if (pos[0] == 'v')
 		{
-			Vector3 v( atof(tokens[1].c_str()), atof(tokens[2].c_str()), atof(tokens[3].c_str()) );
-			indexed_normals.push_back(v);
+			if (pos[1] == ' ' || pos[1] == '\t') num_positions++;
+			else if (pos[1] == 't') num_uvs++;
+			else if (pos[1] == 'n') num_normals++;
 		}
-		else if (tokens[0] == "s") //surface? it appears one time before the faces
+		else if (pos[0] == 'f' && (pos[1] == ' ' || pos[1] == '\t'))
+			num_faces++;
+	}
+	chunk.positions.reserve(num_positions);
+	chunk.normals.reserve(num_normals);
+	chunk.uvs.reserve(num_uvs);
+	chunk.corners.reserve(num_faces * 9); //most faces are triangles, bigger polygons will make it grow
+
+	//second pass: parse
+	chunk.lines = 0;
+	chunk.error_line = 0;
+	for (const char* line = chunk.start; line < end; line = nextLine(line, end))
+	{
+		chunk.lines++;
+		const char* pos = skipSpaces(line, end);
+		if (end - pos < 2)
+			continue;
+
+		if (pos[0] == 'v' && (pos[1] == ' ' || pos[1] == '\t' || pos[1] == 't' || pos[1] == 'n'))
 		{
-			//process mesh
-			if (uvs.size() == 0 && indexed_uvs.size() )
-				uvs.resize(1);
+			char type = pos[1];
+			pos += type == 't' || type == 'n' ? 2 : 1;
+
+			//v and vn need 3 values, vt 2 (the third one is ignored)
+			double value[3];
+			int needed = type == 't' ? 2 : 3;
+			int i = 0;
+			for (; i < needed; i++)
+			{
+				pos = parseFloat(skipSpaces(pos, end), end, value[i]);
+				if (!pos)
+					break;
+			}
+			if (i < needed)
+				continue; //malformed, skip it
+
+			if (type == 't')
+				chunk.uvs.push_back(Vector2(value[0], 1.0 - value[1]));
+			else if (type == 'n')
+				chunk.normals.push_back(Vector3(value[0], value[1], value[2]));
+			else
+				chunk.positions.push_back(Vector3(value[0], value[1], value[2]));
 		}
-		else if (tokens[0] == "f" && tokens.size() >= 4)
+		else if (pos[0] == 'f' && (pos[1] == ' ' || pos[1] == '\t'))
 		{
-			Vector3 v1,v2,v3;
-			v1 = parseVector3( tokens[1].c_str(), '/' );
+			size_t counts[3] = { chunk.positions.size(), chunk.uvs.size(), chunk.normals.size() };
 
-			for (int iPoly = 2; iPoly < tokens.size() - 1; iPoly++)
+			//the polygon is split as a fan around its first corner
+			long long first[3], prev[3], current[3];
+			int corners = 0;
+			pos++;
+			while (true)
 			{
-				v2 = parseVector3( tokens[iPoly].c_str(), '/' );
-				v3 = parseVector3( tokens[iPoly+1].c_str(), '/' );
-
-				vertices.push_back( indexed_positions[ unsigned int(v1.x) -1 ] );
-				vertices.push_back( indexed_positions[ unsigned int(v2.x) -1] );
-				vertices.push_back( indexed_positions[ unsigned int(v3.x) -1] );
-				//triangles.push_back( VECTOR_INDICES_TYPE(vertex_i, vertex_i+1, vertex_i+2) ); //not needed
-				vertex_i += 3;
-
-				if (indexed_uvs.size() > 0)
+				pos = skipSpaces(pos, end);
+				if (pos >= end || *pos == '\n' || *pos == '#')
+					break;
+				pos = parseFaceVertex(pos, end, current);
+				if (!pos)
 				{
-					uvs.push_back( indexed_uvs[ unsigned int(v1.y) -1] );
-					uvs.push_back( indexed_uvs[ unsigned int(v2.y) -1] );
-					uvs.push_back( indexed_uvs[ unsigned int(v3.y) -1] );
+					chunk.error_line = chunk.lines;
+					return;
 				}
+				for (int k = 0; k < 3; k++)
+					if (current[k] < 0)
+						current[k] = counts[k] + current[k] + 1 - OBJ_RELATIVE_INDEX;
 
-				if (indexed_normals.size() > 0)
+				if (corners == 0)
+					memcpy(first, current, sizeof(first));
+				else if (corners >= 2)
 				{
-					normals.push_back( indexed_normals[ unsigned int(v1.z) -1] );
-					normals.push_back( indexed_normals[ unsigned int(v2.z) -1] );
-					normals.push_back( indexed_normals[ unsigned int(v3.z) -1] );
+					chunk.corners.insert(chunk.corners.end(), first, first + 3);
+					chunk.corners.insert(chunk.corners.end(), prev, prev + 3);
+					chunk.corners.insert(chunk.corners.end(), current, current + 3);
 				}
+				memcpy(prev, current, sizeof(prev));
+				corners++;
 			}
 		}
 	}
-
-	return true;
 }
 
+//converts an index stored by parseOBJChunk to a position in the array of the whole file, -1 if it is wrong
+static inline long long resolveIndex(long long index, size_t chunk_first, size_t count)
+{
+	if (index < 0)
+		index += OBJ_RELATIVE_INDEX + chunk_first;
+	if (index > 0 && index <= (long long)count)
+		return index - 1;
+	return -1;
+}
 
-std::vector<std::string> tokenize(const std::string& source, const char* delimiters, bool process_strings )
+bool Mesh::loadOBJ(const char* filename)
 {
-	std::vector<std::string> tokens;
-
-	std::string str;
-	char del_size = strlen(delimiters);
-	const char* pos = source.c_str();
-	char in_string = 0;
-	int i = 0;
-	while(*pos != 0)
+	clear();
+
+	//a binary copy is saved next to the OBJ the first time, it is used while the OBJ does not change
+	std::string path = filename;
+	std::string bin_path = path + ".mbin";
+	if (loadBIN(bin_path.c_str(), path.c_str()))
+	{
+		std::cout << "Loading mesh: " << filename << " (from " << bin_path << ")" << std::endl;
+		return true;
+	}
+
+	std::cout << "Loading mesh: " << filename << std::endl;
+
+	MappedFile file;
+	if (!file.open(path.c_str()))
+	{
+		std::cerr << "File not found: " << filename << std::endl;
+		return false;
+	}
+	const char* end = file.data + file.size;
+
+	//split the file in one chunk per core, cutting always after a line break
+	int num_chunks = std::max(1, std::min((int)std::thread::hardware_concurrency(), (int)(file.size / OBJ_MIN_CHUNK_SIZE)));
+	std::vector<OBJChunk> chunks(num_chunks);
+	const char* start = file.data;
+	for (int i = 0; i < num_chunks; i++)
 	{
-		bool split = false;
+		chunks[i].start = start;
+		chunks[i].end = i == num_chunks - 1 ? end : nextLine(std::max(start, file.data + file.size * (i + 1) / num_chunks - 1), end);
+		start = chunks[i].end;
+	}
+
+	runInThreads(num_chunks, [&](int i) {
+		parseOBJChunk(chunks[i]);
+	});
 
-		if (!process_strings || (process_strings && in_string == 0))
+	//prefix sums: where the elements of every chunk start in the whole file
+	size_t num_positions = 0, num_normals = 0, num_uvs = 0, num_corners = 0;
+	int line_number = 0;
+	for (int i = 0; i < num_chunks; i++)
+	{
+		OBJChunk& chunk = chunks[i];
+		if (chunk.error_line)
 		{
-			for (i = 0; i < del_size && *pos != delimiters[i]; i++);
-			if (i != del_size) split = true;
+			std::cerr << "Wrong face in " << filename << " line " << line_number + chunk.error_line << std::endl;
+			return false;
 		}
+		line_number += chunk.lines;
+
+		chunk.first_position = num_positions;
+		chunk.first_normal = num_normals;
+		chunk.first_uv = num_uvs;
+		num_positions += chunk.positions.size();
+		num_normals += chunk.normals.size();
+		num_uvs += chunk.uvs.size();
+		num_corners += chunk.corners.size() / 3;
+	}
 
-		if (process_strings && (*pos == '\"' || *pos == '\'') )
-		{ 
-			if (!str.empty() && in_string == 0) //some chars remaining
-			{
-				tokens.push_back(str);
-				str.clear();
-			}
-			
-			in_string = (in_string != 0 ? 0 : *pos );
-			if (in_string == 0) 
+	std::vector<Vector3> indexed_positions;
+	std::vector<Vector3> indexed_normals;
+	std::vector<Vector2> indexed_uvs;
+	if (num_chunks == 1)
+	{
+		indexed_positions.swap(chunks[0].positions);
+		indexed_normals.swap(chunks[0].normals);
+		indexed_uvs.swap(chunks[0].uvs);
+	}
+	else
+	{
+		indexed_positions.resize(num_positions);
+		indexed_normals.resize(num_normals);
+		indexed_uvs.resize(num_uvs);
+		runInThreads(num_chunks, [&](int i) {
+			OBJChunk& chunk = chunks[i];
+			std::copy(chunk.positions.begin(), chunk.positions.end(), indexed_positions.begin() + chunk.first_position);
+			std::copy(chunk.normals.begin(), chunk.normals.end(), indexed_normals.begin() + chunk.first_normal);
+			std::copy(chunk.uvs.begin(), chunk.uvs.end(), indexed_uvs.begin() + chunk.first_uv);
+		});
+	}
+
+	//resolve the indices of the corners, every chunk its own ones
+	std::vector<char> wrong_index(num_chunks, 0);
+	runInThreads(num_chunks, [&](int i) {
+		OBJChunk& chunk = chunks[i];
+		for (size_t c = 0; c < chunk.corners.size(); c += 3)
+		{
+			long long position = resolveIndex(chunk.corners[c], chunk.first_position, num_positions);
+			long long uv = num_uvs ? resolveIndex(chunk.corners[c + 1], chunk.first_uv, num_uvs) : 0;
+			long long normal = num_normals ? resolveIndex(chunk.corners[c + 2], chunk.first_normal, num_normals) : 0;
+			if (position < 0 || uv < 0 || normal < 0)
 			{
-				str += *pos;
-				split = true;
+				wrong_index[i] = 1;
+				return;
 			}
+			chunk.corners[c] = position;
+			chunk.corners[c + 1] = uv;
+			chunk.corners[c + 2] = normal;
 		}
+	});
 
-		if (split)
+	for (int i = 0; i < num_chunks; i++)
+		if (wrong_index[i])
 		{
-			if (!str.empty())
+			std::cerr << "Wrong index in " << filename << std::endl;
+			return false;
+		}
+
+	//every different (v, vt, vn) combination becomes one vertex, in the order they are first used.
+	//The combinations already seen are kept in an open addressing hash table that stores the vertex index
+	size_t table_size = 16;
+	while (table_size < num_corners * 2)
+		table_size *= 2;
+	std::vector<unsigned int> table(table_size, MESH_NO_VERTEX);
+	std::vector<long long> vertex_keys; //(v, vt, vn) of every vertex created
+	vertex_keys.reserve(num_positions * 3);
+	vertices.reserve(num_positions);
+	if (num_uvs)
+		uvs.reserve(num_positions);
+	if (num_normals)
+		normals.reserve(num_positions);
+	indices.resize(num_corners);
+
+	size_t corner = 0;
+	for (int i = 0; i < num_chunks; i++)
+	{
+		const std::vector<long long>& corners = chunks[i].corners;
+		for (size_t c = 0; c < corners.size(); c += 3, corner++)
+		{
+			const long long* key = &corners[c];
+			unsigned long long hash = key[0] * 0x9E3779B97F4A7C15ULL ^ key[1] * 0xC2B2AE3D27D4EB4FULL ^ key[2] * 0x165667B19E3779F9ULL;
+			size_t slot = (size_t)(hash ^ (hash >> 29)) & (table_size - 1);
+			while (table[slot] != MESH_NO_VERTEX)
+			{
+				const long long* other = &vertex_keys[table[slot] * 3];
+				if (other[0] == key[0] && other[1] == key[1] && other[2] == key[2])
+					break;
+				slot = (slot + 1) & (table_size - 1);
+			}
+
+			if (table[slot] == MESH_NO_VERTEX)
 			{
-				tokens.push_back(str);
-				str.clear();
+				table[slot] = vertices.size();
+				vertex_keys.insert(vertex_keys.end(), key, key + 3);
+				vertices.push_back(indexed_positions[key[0]]);
+				if (num_uvs)
+					uvs.push_back(indexed_uvs[key[1]]);
+				if (num_normals)
+					normals.push_back(indexed_normals[key[2]]);
 			}
+			indices[corner] = table[slot];
 		}
-		else
-			str += *pos;
-		pos++;
 	}
-	if (!str.empty())
-		tokens.push_back(str);
-	return tokens;
+
+	//the binary copy is saved already optimized, so this is only paid the first time
+	float acmr, atvr, new_acmr, new_atvr;
+	computeVertexCacheStats(MESH_VERTEX_CACHE_SIZE, acmr, atvr);
+	optimizeVertexCache();
+	computeVertexCacheStats(MESH_VERTEX_CACHE_SIZE, new_acmr, new_atvr);
+	std::cout << "Vertex cache: ACMR " << acmr << " -> " << new_acmr << ", ATVR " << atvr << " -> " << new_atvr << std::endl;
+
+	//the streams (and bounds) are ready for the renderer, and the normals are computed from them if the file had none.
+	//They are saved in the binary copy too
+	updateStreams();
+	if (normals.empty())
+		computeNormals();
+
+	if (!saveBIN(bin_path.c_str(), path.c_str()))
+		std::cerr << "Could not save " << bin_path << std::endl;
+
+	return true;
 }
 
+//Forsyth's score of a vertex: high when it is in the cache (it would be free to use) and when it has few triangles left (so it can leave the cache soon)
+static float vertexCacheScore(int cache_position, unsigned int remaining_triangles)
+{
+	if (remaining_triangles == 0)
+		return -1.0f; //nothing else will use it
 
+	float score = 0.0f;
+	if (cache_position >= 0)
+	{
+		if (cache_position < 3)
+			score = 0.75f; //used by the last triangle, fixed score so it does not favour one order of its corners
+		else
+			score = pow(1.0f - (cache_position - 3) / (float)(MESH_VERTEX_CACHE_SIZE - 3), 1.5f);
+	}
+	return score + 2.0f * pow((float)remaining_triangles, -0.5f);
+}
 
-Vector2 parseVector2(const char* text)
+void Mesh::optimizeVertexCache()
 {
-	int pos = 0;
-	char num[255];
-	const char* start = text;
-	const char* current = text;
-	Vector2 result;
+	if (indices.empty())
+		return;
+
+	size_t num_triangles = indices.size() / 3;
+	size_t num_vertices = vertices.size();
+
+	//triangles of every vertex, the ones not emitted yet are kept first in its range
+	std::vector<unsigned int> remaining(num_vertices, 0);
+	std::vector<unsigned int> first_triangle(num_vertices + 1, 0);
+	for (size_t i = 0; i < indices.size(); i++)
+		remaining[indices[i]]++;
+	for (size_t v = 0; v < num_vertices; v++)
+		first_triangle[v + 1] = first_triangle[v] + remaining[v];
+	std::vector<unsigned int> vertex_triangles(indices.size());
+	std::vector<unsigned int> filled(first_triangle.begin(), first_triangle.end() - 1);
+	for (size_t i = 0; i < indices.size(); i++)
+		vertex_triangles[filled[indices[i]]++] = i / 3;
+
+	std::vector<int> cache_position(num_vertices, -1);
+	std::vector<float> vertex_score(num_vertices);
+	for (size_t v = 0; v < num_vertices; v++)
+		vertex_score[v] = vertexCacheScore(-1, remaining[v]);
+
+	std::vector<float> triangle_score(num_triangles);
+	std::vector<char> emitted(num_triangles, 0);
+	int best = 0;
+	for (size_t t = 0; t < num_triangles; t++)
+	{
+		triangle_score[t] = vertex_score[indices[t * 3]] + vertex_score[indices[t * 3 + 1]] + vertex_score[indices[t * 3 + 2]];
+		if (triangle_score[t] > triangle_score[best])
+			best = t;
+	}
+
+	std::vector<unsigned int> new_indices;
+	new_indices.reserve(indices.size());
+	std::vector<unsigned int> cache, new_cache; //most recently used first, it can hold 3 extra vertices before trimming
+	cache.reserve(MESH_VERTEX_CACHE_SIZE + 3);
+	new_cache.reserve(MESH_VERTEX_CACHE_SIZE + 3);
+	size_t next_unemitted = 0;
 
-	while(1)
+	for (size_t n = 0; n < num_triangles; n++)
 	{
-		if (*current == ',' || (*current == '\0' && current != text) )
+		if (best < 0)
 		{
-			strncpy(num, start, current - start);
-			num[current - start] = '\0';
-			start = current + 1;
-			switch(pos)
+			//none of the triangles of the cached vertices is left, take the next one in the original order
+			while (emitted[next_unemitted])
+				next_unemitted++;
+			best = next_unemitted;
+		}
+
+		emitted[best] = 1;
+		const unsigned int* corners = &indices[best * 3];
+		new_indices.insert(new_indices.end(), corners, corners + 3);
+
+		//take it out of the pending triangles of its vertices and put them at the front of the cache
+		new_cache.clear();
+		for (int k = 0; k < 3; k++)
+		{
+			unsigned int v = corners[k];
+			unsigned int* list = &vertex_triangles[first_triangle[v]];
+			for (unsigned int i = 0; i < remaining[v]; i++)
+				if (list[i] == (unsigned int)best)
+				{
+					std::swap(list[i], list[remaining[v] - 1]);
+					break;
+				}
+			remaining[v]--;
+			new_cache.push_back(v);
+		}
+		for (size_t i = 0; i < cache.size(); i++)
+			if (cache[i] != corners[0] && cache[i] != corners[1] && cache[i] != corners[2])
+				new_cache.push_back(cache[i]);
+		cache.swap(new_cache);
+
+		//new scores for the cached vertices (and the ones that just fell out) and their triangles
+		for (size_t i = 0; i < cache.size(); i++)
+		{
+			unsigned int v = cache[i];
+			cache_position[v] = i < MESH_VERTEX_CACHE_SIZE ? (int)i : -1;
+			vertex_score[v] = vertexCacheScore(cache_position[v], remaining[v]);
+		}
+		best = -1;
+		float best_score = -1.0f;
+		for (size_t i = 0; i < cache.size(); i++)
+		{
+			unsigned int v = cache[i];
+			const unsigned int* list = &vertex_triangles[first_triangle[v]];
+			for (unsigned int j = 0; j < remaining[v]; j++)
 			{
-				case 0: result.x = (float)atof(num); break;
-				case 1: result.y = (float)atof(num); break;
-				default: return result; break;
+				unsigned int t = list[j];
+				triangle_score[t] = vertex_score[indices[t * 3]] + vertex_score[indices[t * 3 + 1]] + vertex_score[indices[t * 3 + 2]];
+				if (triangle_score[t] > best_score)
+				{
+					best_score = triangle_score[t];
+					best = t;
+				}
 			}
-			++pos;
-			if (*current == '\0')
-				break;
 		}
+		if (cache.size() > MESH_VERTEX_CACHE_SIZE)
+			cache.resize(MESH_VERTEX_CACHE_SIZE);
+	}
+	indices.swap(new_indices);
 
-		++current;
+	//vertices in the order the triangles use them, so they are also read in order from memory
+	std::vector<unsigned int> remap(num_vertices, MESH_NO_VERTEX);
+	unsigned int next = 0;
+	for (size_t i = 0; i < indices.size(); i++)
+	{
+		if (remap[indices[i]] == MESH_NO_VERTEX)
+			remap[indices[i]] = next++;
+		indices[i] = remap[indices[i]];
+	}
+	for (size_t v = 0; v < num_vertices; v++)
+		if (remap[v] == MESH_NO_VERTEX)
+			remap[v] = next++; //not used by any triangle, keep it at the end
+
+	std::vector<Vector3> old_vertices(vertices);
+	for (size_t v = 0; v < num_vertices; v++)
+		vertices[remap[v]] = old_vertices[v];
+	if (normals.size() == num_vertices)
+	{
+		std::vector<Vector3> old_normals(normals);
+		for (size_t v = 0; v < num_vertices; v++)
+			normals[remap[v]] = old_normals[v];
 	}
-	return result;
+	if (uvs.size() == num_vertices)
+	{
+		std::vector<Vector2> old_uvs(uvs);
+		for (size_t v = 0; v < num_vertices; v++)
+			uvs[remap[v]] = old_uvs[v];
+	}
+	releaseStreams();
 }
 
-Vector3 parseVector3(const char* text, const char separator)
+void Mesh::computeVertexCacheStats(int cache_size, float& acmr, float& atvr)
 {
-	int pos = 0;
-	char num[255];
-	const char* start = text;
-	const char* current = text;
-	Vector3 result;
+	size_t num_corners = indices.size() ? indices.size() : vertices.size();
+	if (num_corners == 0 || vertices.empty())
+	{
+		acmr = atvr = 0.0f;
+		return;
+	}
 
-	while(1)
+	//FIFO cache: a vertex is still there if less than cache_size vertices were transformed after it
+	std::vector<long long> transformed_at(vertices.size(), -(long long)cache_size - 1);
+	long long transforms = 0;
+	for (size_t i = 0; i < num_corners; i++)
 	{
-		if (*current == separator || (*current == '\0' && current != text) )
-		{
-			strncpy(num, start, current - start);
-			num[current - start] = '\0';
-			start = current + 1;
-			if (num[0] != 'x') //?
-				switch(pos)
-				{
-					case 0: result.x = (float)atof(num); break;
-					case 1: result.y = (float)atof(num); break;
-					case 2: result.z = (float)atof(num); break;
-					default: return result; break;
-				}
+		unsigned int v = indices.size() ? indices[i] : i;
+		if (transforms - transformed_at[v] >= cache_size)
+			transformed_at[v] = ++transforms;
+	}
 
-			++pos;
-			if (*current == '\0')
-				break;
-		}
+	acmr = transforms / (float)(num_corners / 3);
+	atvr = transforms / (float)vertices.size();
+}
+
+//header of the binary mesh files, followed by the path of the source file and the vertices, normals, uvs and indices arrays
+typedef struct sMeshBinHeader
+{
+	char magic[4]; //"MBIN"
+	unsigned int version;
+	long long source_size; //size and modification time of the source file when the binary was saved, 0 if it has no source
+	long long source_time;
+	unsigned int source_path_length;
+	unsigned int num_vertices;
+	unsigned int num_normals;
+	unsigned int num_uvs;
+	unsigned int num_indices;
+} MeshBinHeader;
+
+#define MESH_BIN_VERSION 2
+
+//size and modification time of a file, false if it does not exist
+static bool getFileStamp(const char* filename, long long& size, long long& time)
+{
+	struct stat info;
+	if (stat(filename, &info) != 0)
+		return false;
+	size = (long long)info.st_size;
+	time = (long long)info.st_mtime;
+	return true;
+}
+
+bool Mesh::loadBIN(const char* filename, const char* source)
+{
+	MappedFile file;
+	if (!file.open(filename) || file.size < sizeof(MeshBinHeader))
+		return false;
+
+	MeshBinHeader header;
+	memcpy(&header, file.data, sizeof(header));
+	if (memcmp(header.magic, "MBIN", 4) != 0 || header.version != MESH_BIN_VERSION)
+		return false;
+
+	size_t expected = sizeof(header) + header.source_path_length + header.num_vertices * sizeof(Vector3) + header.num_normals * sizeof(Vector3) + header.num_uvs * sizeof(Vector2) + header.num_indices * sizeof(unsigned int);
+	if (file.size != expected)
+		return false; //truncated or corrupted
+	if ((header.num_normals && header.num_normals != header.num_vertices) || (header.num_uvs && header.num_uvs != header.num_vertices))
+		return false; //the streams must be per vertex
 
-		++current;
+	//check that it was made from this source and that the source did not change since then
+	const char* pos = file.data + sizeof(header);
+	if (source)
+	{
+		long long size, time;
+		if (!getFileStamp(source, size, time) || size != header.source_size || time != header.source_time)
+			return false;
+		if (header.source_path_length != strlen(source) || memcmp(pos, source, header.source_path_length) != 0)
+			return false;
 	}
+	pos += header.source_path_length;
+
+	releaseStreams();
+	vertices.resize(header.num_vertices);
+	normals.resize(header.num_normals);
+	uvs.resize(header.num_uvs);
+	indices.resize(header.num_indices);
+	if (header.num_vertices)
+		memcpy(&vertices[0], pos, header.num_vertices * sizeof(Vector3));
+	pos += header.num_vertices * sizeof(Vector3);
+	if (header.num_normals)
+		memcpy(&normals[0], pos, header.num_normals * sizeof(Vector3));
+	pos += header.num_normals * sizeof(Vector3);
+	if (header.num_uvs)
+		memcpy(&uvs[0], pos, header.num_uvs * sizeof(Vector2));
+	pos += header.num_uvs * sizeof(Vector2);
+	if (header.num_indices)
+		memcpy(&indices[0], pos, header.num_indices * sizeof(unsigned int));
+
+	//a corrupted index would read out of the vertices when drawing, parse the source again instead
+	for (size_t i = 0; i < indices.size(); i++)
+		if (indices[i] >= header.num_vertices)
+		{
+			clear();
+			return false;
+		}
 
-	return result;
-};
\ No newline at end of file
+	updateStreams();
+	return true;
+}
+
+bool Mesh::saveBIN(const char* filename, const char* source)
+{
+	MeshBinHeader header;
+	memset(&header, 0, sizeof(header));
+	header.version = MESH_BIN_VERSION;
+	if (source && !getFileStamp(source, header.source_size, header.source_time))
+		return false;
+	header.source_path_length = source ? strlen(source) : 0;
+	header.num_vertices = vertices.size();
+	header.num_normals = normals.size();
+	header.num_uvs = uvs.size();
+	header.num_indices = indices.size();
+
+	FILE* f = fopen(filename, "wb");
+	if (f == NULL)
+		return false;
+
+	//the magic is written last, so a file left half written is never taken as valid
+	bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+	if (ok && header.source_path_length)
+		ok = fwrite(source, header.source_path_length, 1, f) == 1;
+	if (ok && vertices.size())
+		ok = fwrite(&vertices[0], vertices.size() * sizeof(Vector3), 1, f) == 1;
+	if (ok && normals.size())
+		ok = fwrite(&normals[0], normals.size() * sizeof(Vector3), 1, f) == 1;
+	if (ok && uvs.size())
+		ok = fwrite(&uvs[0], uvs.size() * sizeof(Vector2), 1, f) == 1;
+	if (ok && indices.size())
+		ok = fwrite(&indices[0], indices.size() * sizeof(unsigned int), 1, f) == 1;
+	if (ok)
+		ok = fseek(f, 0, SEEK_SET) == 0 && fwrite("MBIN", 4, 1, f) == 1;
+	ok = fclose(f) == 0 && ok;
+
+	if (!ok)
+		remove(filename);
+	return ok;
+}
@@ -6,23 +6,88 @@
 #define MESH_H
 
 #include <vector>
+#include <cstdlib>
+#include <new>
 #include "framework.h"
 #include "camera.h"
 #include "image.h"
 
+//big OBJ files are parsed by several threads, each one taking at least this many bytes
+#define OBJ_MIN_CHUNK_SIZE (256 * 1024)
+//vertices kept by the post-transform cache the triangle order is optimized for
+#define MESH_VERTEX_CACHE_SIZE 32
+//the vertex streams are aligned to this many bytes and padded to a multiple of this many floats, so SIMD loops need no remainder
+#define MESH_STREAM_ALIGNMENT 32
+#define MESH_STREAM_PADDING 8
+
+//allocator for the vertex streams, it aligns them to MESH_STREAM_ALIGNMENT bytes
+template <typename T> struct StreamAllocator
+{
+	typedef T value_type;
+	StreamAllocator() {}
+	template <typename U> StreamAllocator(const StreamAllocator<U>&) {}
+
+	T* allocate(size_t n)
+	{
+		//enough extra bytes to move it to an aligned address and remember where the block started just before it
+		char* block = (char*)malloc(n * sizeof(T) + MESH_STREAM_ALIGNMENT + sizeof(void*));
+		if (block == NULL)
+			throw std::bad_alloc();
+		char* aligned = (char*)(((size_t)block + sizeof(void*) + MESH_STREAM_ALIGNMENT - 1) & ~(size_t)(MESH_STREAM_ALIGNMENT - 1));
+		((void**)aligned)[-1] = block;
+		return (T*)aligned;
+	}
+	void deallocate(T* p, size_t) { free(((void**)p)[-1]); }
+
+	template <typename U> bool operator == (const StreamAllocator<U>&) const { return true; }
+	template <typename U> bool operator != (const StreamAllocator<U>&) const { return false; }
+};
+typedef std::vector< float, StreamAllocator<float> > FloatStream;
+
 class Mesh
 {
 public:
 	std::vector< Vector3 > vertices; //here we store the vertices
 	std::vector< Vector3 > normals;	 //here we store the normals
 	std::vector< Vector2 > uvs;	 //here we store the texture coordinates
+	std::vector< unsigned int > indices; //three per triangle, if empty every three vertices are a triangle
+
+	//optional structure of arrays copy of the vertices: x, y and z in separate aligned arrays, padded with copies of
+	//the last vertex, so the CPU loops read several vertices per instruction. The loaders fill it, updateStreams refreshes it
+	FloatStream position_stream[3];
+	int num_stream_vertices; //vertices in the streams, without the padding
+
+	//box containing all the vertices, updateStreams and the loaders refresh it
+	Vector3 aabb_min;
+	Vector3 aabb_max;
 
 	Mesh();
 	void clear();
 	void render(Camera* camera, Image* framebuffer); //TODO
 
+	void updateStreams(); //copies the vertices to the streams and computes the bounds
+	void releaseStreams(); //the functions that change the vertices call it, the streams would be out of date
+	bool hasStreams() const { return num_stream_vertices > 0 && num_stream_vertices == (int)vertices.size(); }
+
+	//these use the streams (4 vertices at a time) when they are up to date and the vertices otherwise
+	void computeBounds(); //fills aabb_min and aabb_max
+	void computeNormals(); //smooth normals, the sum of the normals of the triangles of every vertex (so weighted by their area), normalized. loadOBJ uses it when the file has none
+
 	void createPlane(float size);
+	//loads the file as an indexed mesh (the vertices repeated in several faces are stored only once).
+	//It uses one thread per core for big files and keeps a binary copy (filename.mbin) to load it faster next time
 	bool loadOBJ(const char* filename);
+
+	//binary mesh files, they are loaded with a single copy of every array. If source is given the binary
+	//remembers that file and loadBIN fails when the source has changed since it was saved
+	bool loadBIN(const char* filename, const char* source = NULL);
+	bool saveBIN(const char* filename, const char* source = NULL);
+
+	//reorders the triangles so their vertices are reused while they are still in the post-transform cache (Forsyth's algorithm),
+	//then the vertices in the order the triangles use them. loadOBJ already does it, only for indexed meshes
+	void optimizeVertexCache();
+	//average vertices transformed per triangle (ACMR) and per vertex (ATVR) with a FIFO cache of cache_size vertices
+	void computeVertexCacheStats(int cache_size, float& acmr, float& atvr);
 };
 
 
@@ -0,0 +1,90 @@
+#include "threadpool.h"
+#include <algorithm>
+
+ThreadPool::ThreadPool(int num_threads)
+{
+	if (num_threads <= 0)
+		num_threads = std::max(1, (int)std::thread::hardware_concurrency());
+
+	job = NULL;
+	job_count = 0;
+	next_job = 0;
+	running = 0;
+	batch = 0;
+	quit = false;
+
+	//the calling thread also works, so we only need num_threads - 1 workers
+	for (int i = 1; i < num_threads; i++)
+		workers.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	start_condition.notify_all();
+	for (size_t i = 0; i < workers.size(); i++)
+		workers[i].join();
+}
+
+void ThreadPool::parallelFor(int count, const std::function<void(int, int)>& job)
+{
+	if (count <= 0)
+		return;
+
+	//not worth waking up the workers
+	if (workers.empty() || count == 1)
+	{
+		for (int i = 0; i < count; i++)
+			job(i, 0);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		this->job = &job;
+		job_count = count;
+		next_job = 0;
+		running = (int)workers.size();
+		batch++;
+	}
+	start_condition.notify_all();
+
+	runJobs(0);
+
+	//wait for the workers to finish their last job
+	std::unique_lock<std::mutex> lock(mutex);
+	done_condition.wait(lock, [this]() { return running == 0; });
+	this->job = NULL;
+}
+
+void ThreadPool::workerLoop(int thread)
+{
+	unsigned int last_batch = 0;
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			start_condition.wait(lock, [&]() { return quit || batch != last_batch; });
+			if (quit)
+				return;
+			last_batch = batch;
+		}
+
+		runJobs(thread);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if (--running == 0)
+			done_condition.notify_one();
+	}
+}
+
+void ThreadPool::runJobs(int thread)
+{
+	//every thread takes the next free index until there are no more
+	int i;
+	while ((i = next_job++) < job_count)
+		(*job)(i, thread);
+}
@@ -0,0 +1,46 @@
+/*  This class keeps a group of worker threads alive so the work of every frame can be split between all the cores
+	without paying the creation of new threads each time.
+*/
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+class ThreadPool
+{
+public:
+	//num_threads includes the thread that calls parallelFor, 0 means one per core
+	ThreadPool(int num_threads = 0);
+	~ThreadPool();
+
+	//number of threads that run jobs (the workers plus the calling thread)
+	int size() const { return (int)workers.size() + 1; }
+
+	//calls job(index, thread) for every index in [0, count) spreading them among all the threads,
+	//thread is in [0, size()) and identifies who is running it. It returns when all the jobs are done
+	void parallelFor(int count, const std::function<void(int, int)>& job);
+
+private:
+	void workerLoop(int thread);
+	void runJobs(int thread);
+
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable start_condition;
+	std::condition_variable done_condition;
+
+	const std::function<void(int, int)>* job;
+	int job_count;
+	std::atomic<int> next_job;
+	int running; //workers that have not finished the current batch
+	unsigned int batch; //increased every parallelFor so the workers know there is new work
+	bool quit;
+};
+
+#endif
@@ -1,3 +1,6 @@
+#version 120
+#extension GL_ARB_uniform_buffer_object : require
+
 //this var comes from the vertex shader
 //they are baricentric interpolated by pixel according to the distance to every vertex
 varying vec3 v_wPos;
@@ -6,20 +9,31 @@ varying vec2 v_coord;
 
 
 //here create uniforms for all the data we need here
-uniform vec3 camera_position;
-uniform vec3 ambient_light;
-
-
-uniform vec3 light_position;
-uniform vec3 light_diffuse;
-uniform vec3 light_specular;
+//values shared by all the draws of the frame (see Application::FrameBlock)
+layout(std140) uniform FrameBlock
+{
+	mat4 viewprojection;
+	vec3 camera_position;
+	vec3 ambient_light;
+};
 
-uniform vec3 material_diffuse;
-uniform vec3 material_specular;
-uniform vec3 material_ambient;
 
+//the light (see Light::bind)
+layout(std140) uniform LightBlock
+{
+	vec3 light_position;
+	vec3 light_diffuse;
+	vec3 light_specular;
+};
 
-uniform float material_shininess;
+//the material of the draw (see Material::bind)
+layout(std140) uniform MaterialBlock
+{
+	vec3 material_ambient;
+	vec3 material_diffuse;
+	vec3 material_specular;
+	float material_shininess;
+};
 
 uniform sampler2D color_texture; 
 uniform sampler2D normal_texture;
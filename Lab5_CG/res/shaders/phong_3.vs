@@ -1,6 +1,16 @@
+#version 120
+#extension GL_ARB_uniform_buffer_object : require
+
 //global variables from the CPU
 uniform mat4 model;
-uniform mat4 viewprojection;
+
+//values shared by all the draws of the frame (see Application::FrameBlock)
+layout(std140) uniform FrameBlock
+{
+	mat4 viewprojection;
+	vec3 camera_position;
+	vec3 ambient_light;
+};
 
 
 //vars to pass to the pixel shader
@@ -0,0 +1,67 @@
+#version 120
+#extension GL_ARB_uniform_buffer_object : require
+
+//this var comes from the vertex shader
+//they are baricentric interpolated by pixel according to the distance to every vertex
+varying vec3 v_wPos;
+varying vec2 v_coord;
+
+//same for every pixel of an instance
+varying mat3 v_normal_matrix;
+varying vec3 v_material_ambient;
+varying vec3 v_material_diffuse;
+varying vec3 v_material_specular;
+varying float v_material_shininess;
+
+//here create uniforms for all the data we need here
+//values shared by all the draws of the frame (see Application::FrameBlock)
+layout(std140) uniform FrameBlock
+{
+	mat4 viewprojection;
+	vec3 camera_position;
+	vec3 ambient_light;
+};
+
+
+//the light (see Light::bind)
+layout(std140) uniform LightBlock
+{
+	vec3 light_position;
+	vec3 light_diffuse;
+	vec3 light_specular;
+};
+
+uniform sampler2D color_texture; 
+uniform sampler2D normal_texture;
+
+
+void main()
+{
+	//here we set up the normal as a color to see them as a debug
+	vec3 texture_normal = texture2D( normal_texture, v_coord ).xyz;
+
+	texture_normal = (texture_normal - 0.5) / 0.5; // adapt the range [0, 1] to [-1, 1]
+	vec3 wNormal = v_normal_matrix * texture_normal; // normal is affected by the model matrix
+
+	//here write the computations for PHONG.
+	vec3 N = normalize(wNormal);
+	vec3 L = normalize(light_position - v_wPos); // Get a lighting direction vector from the light to the vertex.
+	vec3 V = normalize(camera_position - v_wPos);
+	vec3 R = reflect(-L, N);
+
+	vec4 tex_color = texture2D( color_texture, v_coord );
+
+
+	vec3 Kd = tex_color.xyz * v_material_diffuse;
+	vec3 Ks = (tex_color.xyz*tex_color.w) * v_material_specular;
+	vec3 Ka = tex_color.xyz*v_material_ambient;
+
+	vec3 Ld = Kd * max(dot(N, L), 0.0) * light_diffuse;
+	vec3 Ls =  Ks * pow(max(dot(R, V), 0.0), v_material_shininess) * light_specular;
+	vec3 La =  Ka * ambient_light;
+
+	vec3 color =  Ld + Ls + La;
+
+	//set the ouput color por the pixel
+	gl_FragColor = vec4( color, 1.0 ) * 1.0;
+}
\ No newline at end of file
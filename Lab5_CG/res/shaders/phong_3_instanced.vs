@@ -0,0 +1,51 @@
+#version 120
+#extension GL_ARB_uniform_buffer_object : require
+
+//global variables from the CPU
+
+//values shared by all the draws of the frame (see Application::FrameBlock)
+layout(std140) uniform FrameBlock
+{
+	mat4 viewprojection;
+	vec3 camera_position;
+	vec3 ambient_light;
+};
+
+//per instance attributes (one value for every model drawn in the same call)
+attribute mat4 i_model;
+attribute vec3 i_material_ambient;
+attribute vec3 i_material_diffuse;
+attribute vec3 i_material_specular;
+attribute float i_material_shininess;
+
+//vars to pass to the pixel shader
+varying vec3 v_wPos;
+varying vec2 v_coord;
+
+//the pixel shader needs the rotation of the model and the material of the instance
+varying mat3 v_normal_matrix;
+varying vec3 v_material_ambient;
+varying vec3 v_material_diffuse;
+varying vec3 v_material_specular;
+varying float v_material_shininess;
+
+void main()
+{	
+	//convert local coordinate to world coordinates
+	vec3 wPos = (i_model * vec4( gl_Vertex.xyz, 1.0)).xyz;
+
+	//pass them to the pixel shader interpolated
+	v_wPos = wPos;
+
+	//get the texture coordinates (per vertex) and pass them to the pixel shader
+	v_coord = gl_MultiTexCoord0.xy;
+
+	v_normal_matrix = mat3( i_model[0].xyz, i_model[1].xyz, i_model[2].xyz );
+	v_material_ambient = i_material_ambient;
+	v_material_diffuse = i_material_diffuse;
+	v_material_specular = i_material_specular;
+	v_material_shininess = i_material_shininess;
+
+	//project the vertex by the model view projection 
+	gl_Position = viewprojection * vec4(wPos,1.0); //output of the vertex shader
+}
\ No newline at end of file
@@ -7,7 +7,7 @@
 #include "texture.h"
 #include "light.h"
 #include "material.h"
-
+#include "renderqueue.h"
 
 Camera* camera = NULL;
 
@@ -21,8 +21,16 @@ Shader* shader_phong_1 = NULL;
 Shader* shader_phong_2 = NULL;
 Shader* shader_phong_3 = NULL;
 Shader* shader_phong_4 = NULL;
+Shader* shader_phong_3_instanced = NULL;
 Texture* texture = NULL;
 Texture* normal_text = NULL;
+UniformBuffer* frame_block = NULL;
+RenderQueue* render_queue = NULL;
+GLenum cull_face = GL_BACK; //faces the GPU discards in the draws of the lee, 0 for none (press C to switch)
+
+//bounding spheres of the models in world space, in separate arrays for Camera::testSpheres
+std::vector<float> sphere_x, sphere_y, sphere_z, sphere_radius;
+std::vector<unsigned char> model_visible;
 
 Light* light = new Light();
 
@@ -30,6 +38,27 @@ Vector3 ambient_light(0.1, 0.2, 0.3);
 Material* material = new Material();
 
 float angle = 0;
+
+//bounding sphere of the mesh moved by the model: the radius grows with the biggest scale of its axes
+static void transformSphere(const Matrix44& model, Mesh* mesh, Vector3& center, float& radius)
+{
+	const float* m = model.m;
+	float scale = std::max(m[0] * m[0] + m[1] * m[1] + m[2] * m[2], std::max(m[4] * m[4] + m[5] * m[5] + m[6] * m[6], m[8] * m[8] + m[9] * m[9] + m[10] * m[10]));
+	center = model * mesh->center;
+	radius = mesh->radius * sqrt(scale);
+}
+
+//the box of the mesh moved by the model, in world space: every axis of the box adds its projection to the half size (Arvo)
+static bool isModelVisible(const Matrix44& model, Mesh* mesh)
+{
+	const float* m = model.m;
+	Vector3 half = (mesh->aabb_max - mesh->aabb_min) * 0.5f;
+	Vector3 center = model * mesh->center;
+	Vector3 extent(fabs(m[0]) * half.x + fabs(m[4]) * half.y + fabs(m[8]) * half.z,
+		fabs(m[1]) * half.x + fabs(m[5]) * half.y + fabs(m[9]) * half.z,
+		fabs(m[2]) * half.x + fabs(m[6]) * half.y + fabs(m[10]) * half.z);
+	return camera->testBox(center - extent, center + extent);
+}
 Application::Application(const char* caption, int width, int height)
 {
 	this->window = createWindow(caption, width, height);
@@ -43,6 +72,9 @@ Application::Application(const char* caption, int width, int height)
 	this->window_width = w;
 	this->window_height = h;
 	this->keystate = SDL_GetKeyboardState(NULL);
+	this->shader_stats.issued = this->shader_stats.skipped = 0;
+	memset(&this->queue_stats, 0, sizeof(this->queue_stats));
+	this->culled_draws = 0;
 } 
 
 //Here we have already GL working, so we can create meshes and textures
@@ -59,20 +91,18 @@ void Application::init(void)
 	mesh = new Mesh();
 	mesh->loadOBJ("../res/meshes/lee.obj");
 
-	//load the texture
-	texture = new Texture();
-	normal_text = new Texture();
-	if(!texture->load("../res/textures/lee_color_specular.tga") || !normal_text->load("../res/textures/lee_normal.tga"))
-	{
-		std::cout << "Texture not found" << std::endl;
-		exit(1);
-	}
+	//load the textures, they are read in other threads and shown as soon as they are uploaded
+	texture = Texture::Get("../res/textures/lee_color_specular.tga");
+	normal_text = Texture::Get("../res/textures/lee_normal.tga");
 	 
 	//we load a shader
 	shader = Shader::Get("../res/shaders/phong.vs","../res/shaders/phong.fs");
 	shader_phong_1 = Shader::Get("../res/shaders/phong.vs", "../res/shaders/phong.fs");
 	shader_phong_2 = Shader::Get("../res/shaders/phong_2.vs", "../res/shaders/phong_2.fs");
 	shader_phong_3 = Shader::Get("../res/shaders/phong_3.vs", "../res/shaders/phong_3.fs");
+	shader_phong_3_instanced = Shader::Get("../res/shaders/phong_3_instanced.vs", "../res/shaders/phong_3_instanced.fs");
+	frame_block = new UniformBuffer("FrameBlock", UNIFORM_BLOCK_FRAME);
+	render_queue = new RenderQueue();
 
 
 	mode = 0;
@@ -84,134 +114,82 @@ void Application::init(void)
 //render one frame
 void Application::render(void)
 {
+	//textures finished by the loader threads since the last frame
+	Texture::UploadPending();
+
 	// Clear the window and the depth buffer
 
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	glEnable(GL_DEPTH_TEST);
-	
-		if (mode == 1 || mode == 2) {
-			if (mode == 1) {
-				shader = shader_phong_1;
-			}
-			else if (mode == 2) {
-				shader = shader_phong_2;
-			}
-			
-
-			//Get the viewprojection
-			camera->aspect = window_width / window_height;
-			Matrix44 viewprojection = camera->getViewProjectionMatrix();
-
-			//enable the shader
-			shader->enable();
-			shader->setMatrix44("model", model_matrix); //upload info to the shader
-			shader->setMatrix44("viewprojection", viewprojection); //upload info to the shader
-
-			shader->setTexture("color_texture", texture, 0); //set texture in slot 0
-
-			shader->setUniform3("camera_position", camera->eye);
-			shader->setUniform3("ambient_light", ambient_light);
-
-			shader->setUniform1("material_shininess", material->shininess);
-			shader->setUniform3("material_ambient",material->ambient);
-			shader->setUniform3("material_diffuse" ,material->diffuse);
-			shader->setUniform3("material_specular", material->specular);
 
-			shader->setUniform3("light_position", light->position);
-			shader->setUniform3("light_diffuse", light->diffuse_color);
-			shader->setUniform3("light_specular", light->specular_color);
-
-			//render the data
-			mesh->render(GL_TRIANGLES);
-
-			//disable shader
-			shader->disable();
-
-			//swap between front buffer and back buffer
-			SDL_GL_SwapWindow(this->window);
+	//Get the viewprojection
+	camera->aspect = window_width / window_height;
+	Matrix44 viewprojection = camera->getViewProjectionMatrix();
+
+	//the camera, ambient and light values are the same for every draw, they are uploaded once per frame
+	FrameBlock frame = FrameBlock(); //zeroes the pads too
+	frame.viewprojection = viewprojection;
+	frame.camera_position = camera->eye;
+	frame.ambient_light = ambient_light;
+	frame_block->upload(&frame, sizeof(frame));
+	frame_block->bind();
+	light->bind();
+	
+	//every mode only says what to draw, the queue decides the order and the state changes.
+	//The draws outside the camera are skipped here, before anything of them is sent
+	culled_draws = 0;
+	if (mode == 1 || mode == 2 || mode == 3) {
+		if (mode == 1) {
+			shader = shader_phong_1;
 		}
-		else if (mode == 3 ) {
-			shader = shader_phong_3;
-
-
-			// Clear the window and the depth buffer
-			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-			glEnable(GL_DEPTH_TEST);
-
-			//Get the viewprojection 
-			camera->aspect = window_width / window_height;
-			Matrix44 viewprojection = camera->getViewProjectionMatrix();
-
-			//enable the shader
-			shader->enable();
-			shader->setMatrix44("model", model_matrix); //upload info to the shader
-			shader->setMatrix44("viewprojection", viewprojection); //upload info to the shader
-
-			shader->setTexture("color_texture", texture, 0); //set texture in slot 0
-			shader->setTexture("normal_texture", normal_text, 1); //set texture in slot 1
-			shader->setUniform3("camera_position", camera->eye);
-			shader->setUniform3("ambient_light", ambient_light);
-
-			shader->setUniform1("material_shininess", material->shininess);
-			shader->setUniform3("material_ambient", material->ambient);
-			shader->setUniform3("material_diffuse", material->diffuse);
-			shader->setUniform3("material_specular", material->specular);
-
-
-			shader->setUniform3("light_position", light->position);
-			shader->setUniform3("light_diffuse", light->diffuse_color);
-			shader->setUniform3("light_specular", light->specular_color);
-
-			//render the data
-			mesh->render(GL_TRIANGLES);
-
-			//disable shader
-			shader->disable();
-
-			//swap between front buffer and back buffer
-			SDL_GL_SwapWindow(this->window);
+		else if (mode == 2) {
+			shader = shader_phong_2;
 		}
-		else if (mode == 4) {
+		else {
 			shader = shader_phong_3;
-			// Clear the window and the depth buffer
-			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-			glEnable(GL_DEPTH_TEST);
-
-			//Get the viewprojection 
-			camera->aspect = window_width / window_height;
-			Matrix44 viewprojection = camera->getViewProjectionMatrix();
-			for (int i = 0; i < models.size(); ++i) {
-				//enable the shader
-				shader->enable();
-				shader->setMatrix44("model", models[i].model); //upload info to the shader
-				shader->setMatrix44("viewprojection", viewprojection); //upload info to the shader
-
-				shader->setTexture("color_texture", texture, 0); //set texture in slot 0
-				shader->setTexture("normal_texture", normal_text, 1); //set texture in slot 1
-				shader->setUniform3("camera_position", camera->eye);
-				shader->setUniform3("ambient_light", ambient_light);
-
-				shader->setUniform1("material_shininess", models[i].material->shininess);
-				shader->setUniform3("material_ambient", models[i].material->ambient);
-				shader->setUniform3("material_diffuse", models[i].material->diffuse);
-				shader->setUniform3("material_specular", models[i].material->specular);
-
-
-				shader->setUniform3("light_position", light->position);
-				shader->setUniform3("light_diffuse", light->diffuse_color);
-				shader->setUniform3("light_specular", light->specular_color);
-
-				//render the data
-				mesh->render(GL_TRIANGLES);
+		}
+		Vector3 center;
+		float radius;
+		transformSphere(model_matrix, mesh, center, radius);
+		if (camera->testSphere(center, radius) && isModelVisible(model_matrix, mesh))
+			render_queue->submit(mesh, shader, material, model_matrix, texture, mode == 3 ? normal_text : NULL, cull_face);
+		else
+			culled_draws++;
+	}
+	else if (mode == 4) {
+		//spheres of all the models first, tested 4 at a time, then the boxes of the ones that pass
+		int count = models.size();
+		sphere_x.resize(count);
+		sphere_y.resize(count);
+		sphere_z.resize(count);
+		sphere_radius.resize(count);
+		model_visible.resize(count);
+		for (int i = 0; i < count; ++i) {
+			Vector3 center;
+			transformSphere(models[i].model, mesh, center, sphere_radius[i]);
+			sphere_x[i] = center.x;
+			sphere_y[i] = center.y;
+			sphere_z[i] = center.z;
+		}
+		if (count)
+			camera->testSpheres(&sphere_x[0], &sphere_y[0], &sphere_z[0], &sphere_radius[0], count, &model_visible[0]);
+
+		//the instanced shader reads the model and material of every draw as instance attributes, so the queue draws them all with a single call
+		for (int i = 0; i < count; ++i) {
+			if (model_visible[i] && isModelVisible(models[i].model, mesh))
+				render_queue->submit(mesh, shader_phong_3_instanced, models[i].material, models[i].model, texture, normal_text, cull_face);
+			else
+				culled_draws++;
+		}
+	}
+	render_queue->flush(camera);
+	queue_stats = render_queue->stats;
 
-				//disable shader
-				shader->disable();
-			}
+	//swap between front buffer and back buffer
+	SDL_GL_SwapWindow(this->window);
 
-			//swap between front buffer and back buffer
-			SDL_GL_SwapWindow(this->window);
-		}
-	
+	shader_stats = Shader::s_stats;
+	Shader::ResetStats();
 }
 
 //called after render
@@ -252,6 +230,16 @@ void Application::onKeyPressed( SDL_KeyboardEvent event )
 		case SDL_SCANCODE_2: mode = 2; break;
 		case SDL_SCANCODE_3: mode = 3; break;
 		case SDL_SCANCODE_4: mode = 4; break;
+		case SDL_SCANCODE_I:
+			std::cout << "GL state calls in the last frame: " << shader_stats.issued << " issued, " << shader_stats.skipped << " skipped" << std::endl;
+			std::cout << "Render queue: " << queue_stats.items << " draws in " << queue_stats.calls << " calls, " << queue_stats.shader_changes << " shader, " << queue_stats.texture_changes << " texture, " << queue_stats.material_changes << " material and " << queue_stats.cull_changes << " cull changes" << std::endl;
+			std::cout << "Triangles: " << queue_stats.triangles << " submitted, " << queue_stats.face_culling_triangles << " of them in draws with face culling on" << std::endl;
+			std::cout << "Frustum culling: " << culled_draws << " draws outside the camera" << std::endl;
+			break;
+		case SDL_SCANCODE_C:
+			cull_face = cull_face ? 0 : GL_BACK;
+			std::cout << "Back face culling: " << (cull_face ? "yes" : "no") << std::endl;
+			break;
 	}
 	if (keystate[SDL_SCANCODE_M]) {
 
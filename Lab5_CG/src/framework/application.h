@@ -8,6 +8,8 @@
 #include "includes.h"
 #include "framework.h"
 #include "material.h"
+#include "shader.h"
+#include "renderqueue.h"
 
 class Application
 {
@@ -26,8 +28,20 @@ public:
 
 	std::vector<Model> models;
 
+	//values shared by all the draws of a frame, in the layout of the FrameBlock uniform block (std140)
+	typedef struct frameBlock {
+		Matrix44 viewprojection;
+		Vector3 camera_position; float pad0;
+		Vector3 ambient_light; float pad1;
+	}FrameBlock;
+
 	float time;
 
+	//GL calls issued and skipped by the shaders in the last frame (press I to print them)
+	ShaderStats shader_stats;
+	RenderQueueStats queue_stats;
+	int culled_draws; //outside the camera in the last frame, they were not submitted
+
 	//keyboard state
 	const Uint8* keystate;
 
@@ -103,6 +103,7 @@ void Camera::updateViewMatrix()
 	//We get the matrix and store it in our app
 	glGetFloatv(GL_MODELVIEW_MATRIX, view_matrix.m );
 	viewprojection_matrix = view_matrix * projection_matrix;
+	updateFrustumPlanes();
 }
 
 // ******************************************
@@ -126,6 +127,7 @@ void Camera::updateProjectionMatrix()
 
 	glMatrixMode(GL_MODELVIEW);
 	viewprojection_matrix = view_matrix * projection_matrix;
+	updateFrustumPlanes();
 }
 
 Matrix44 Camera::getViewProjectionMatrix()
@@ -133,5 +135,87 @@ Matrix44 Camera::getViewProjectionMatrix()
 	updateViewMatrix();
 	updateProjectionMatrix();
 	viewprojection_matrix = view_matrix * projection_matrix;
+	updateFrustumPlanes();
 	return viewprojection_matrix;
 }
+
+void Camera::updateFrustumPlanes()
+{
+	//every plane is the last row of the matrix plus or minus one of the others (Gribb-Hartmann), row i being m[i], m[i + 4], m[i + 8], m[i + 12]
+	const float* m = viewprojection_matrix.m;
+	for (int i = 0; i < 6; i++)
+	{
+		int row = i / 2;
+		float sign = (i % 2) ? -1.0f : 1.0f;
+		Vector4& plane = frustum_planes[i];
+		plane.set(m[3] + sign * m[row], m[7] + sign * m[row + 4], m[11] + sign * m[row + 8], m[15] + sign * m[row + 12]);
+		float length = sqrt(plane.x * plane.x + plane.y * plane.y + plane.z * plane.z);
+		if (length > 0)
+			plane.set(plane.x / length, plane.y / length, plane.z / length, plane.w / length);
+	}
+}
+
+bool Camera::testSphere(const Vector3& center, float radius) const
+{
+	for (int i = 0; i < 6; i++)
+	{
+		const Vector4& plane = frustum_planes[i];
+		float distance = plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w;
+		if (distance + radius < 0)
+			return false;
+	}
+	return true;
+}
+
+bool Camera::testBox(const Vector3& box_min, const Vector3& box_max) const
+{
+	for (int i = 0; i < 6; i++)
+	{
+		//the corner of the box that is the most inside the plane
+		const Vector4& plane = frustum_planes[i];
+		float x = plane.x > 0 ? box_max.x : box_min.x;
+		float y = plane.y > 0 ? box_max.y : box_min.y;
+		float z = plane.z > 0 ? box_max.z : box_min.z;
+		if (plane.x * x + plane.y * y + plane.z * z + plane.w < 0)
+			return false;
+	}
+	return true;
+}
+
+int Camera::testSpheres(const float* x, const float* y, const float* z, const float* radius, int count, unsigned char* visible) const
+{
+	int num_visible = 0;
+	int i = 0;
+
+#ifdef FRAMEWORK_SSE
+	//4 spheres at a time, with the same operations as testSphere
+	__m128 zero = _mm_setzero_ps();
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 cx = _mm_loadu_ps(x + i);
+		__m128 cy = _mm_loadu_ps(y + i);
+		__m128 cz = _mm_loadu_ps(z + i);
+		__m128 r = _mm_loadu_ps(radius + i);
+		__m128 outside = _mm_setzero_ps();
+		for (int p = 0; p < 6; p++)
+		{
+			const Vector4& plane = frustum_planes[p];
+			__m128 distance = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.x), cx), _mm_mul_ps(_mm_set1_ps(plane.y), cy)), _mm_mul_ps(_mm_set1_ps(plane.z), cz)), _mm_set1_ps(plane.w));
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, r), zero));
+		}
+		int mask = _mm_movemask_ps(outside);
+		for (int k = 0; k < 4; k++)
+		{
+			visible[i + k] = (mask >> k) & 1 ? 0 : 1;
+			num_visible += visible[i + k];
+		}
+	}
+#endif
+
+	for (; i < count; i++)
+	{
+		visible[i] = testSphere(Vector3(x[i], y[i], z[i]), radius[i]) ? 1 : 0;
+		num_visible += visible[i];
+	}
+	return num_visible;
+}
@@ -37,6 +37,10 @@ public:
 	Matrix44 projection_matrix;
 	Matrix44 viewprojection_matrix;
 
+	//planes of the view frustum (left, right, bottom, top, near and far) taken from the viewprojection_matrix, normalized and
+	//facing inside: a point p is inside a plane when plane.x * p.x + plane.y * p.y + plane.z * p.z + plane.w >= 0
+	Vector4 frustum_planes[6];
+
 	Camera();
 	void set();
 
@@ -55,6 +59,15 @@ public:
 	//compute the matrices
 	void updateViewMatrix();
 	void updateProjectionMatrix();
+	void updateFrustumPlanes(); //called every time the viewprojection_matrix changes
+
+	//false if the sphere (or the box) in world space is completely outside the frustum. It can be true for some that are
+	//outside too, near the corners, so it is only good to skip draws
+	bool testSphere(const Vector3& center, float radius) const;
+	bool testBox(const Vector3& box_min, const Vector3& box_max) const;
+	//tests count spheres (the centers and radii in separate arrays) with SSE, 4 at a time, and sets visible[i] to testSphere of
+	//the sphere i. Returns how many are visible
+	int testSpheres(const float* x, const float* y, const float* z, const float* radius, int count, unsigned char* visible) const;
 
 	Matrix44 getViewProjectionMatrix();
 };
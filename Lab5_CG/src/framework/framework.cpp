@@ -275,6 +275,20 @@ Matrix44 Matrix44::operator*(const Matrix44& matrix) const
 {
 	Matrix44 ret;
 
+#ifdef FRAMEWORK_SSE
+	//every row of the result is the rows of the other matrix weighted by this row, the sums are done in the same order as below
+	__m128 rows[4];
+	for (int k = 0; k < 4; k++)
+		rows[k] = _mm_loadu_ps(matrix.M[k]);
+	for (int i = 0; i < 4; i++)
+	{
+		__m128 row = _mm_mul_ps(_mm_set1_ps(M[i][0]), rows[0]);
+		row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(M[i][1]), rows[1]));
+		row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(M[i][2]), rows[2]));
+		row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(M[i][3]), rows[3]));
+		_mm_storeu_ps(ret.M[i], row);
+	}
+#else
 	unsigned int i,j,k;
 	for (i=0;i<4;i++) 	
 	{
@@ -285,6 +299,7 @@ Matrix44 Matrix44::operator*(const Matrix44& matrix) const
 				ret.M[i][j] += M[i][k] * matrix.M[k][j];
 		}
 	}
+#endif
 
 	return ret;
 }
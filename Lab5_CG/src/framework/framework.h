@@ -9,6 +9,12 @@
 #include <cmath>
 #include <random>
 
+//SSE is in every x86 CPU with 64 bits (and any 32 bits one built with it), there is no need to check for it at runtime
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+	#include <xmmintrin.h>
+	#define FRAMEWORK_SSE
+#endif
+
 #ifndef PI
 #define PI 3.14159265359
 #endif
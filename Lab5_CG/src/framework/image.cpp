@@ -1,4 +1,5 @@
 #include "image.h"
+#include <vector>
 #include "utils.h"
 #include <string>
 
@@ -119,10 +120,110 @@ void Image::flipY()
 }
 
 //Loads an image from a TGA file
+bool Image::checkTGAHeader(const unsigned char* header, bool& rle)
+{
+	//no id field, no color map and true color, uncompressed (type 2) or RLE (type 10)
+	static const unsigned char TGAheader[12] = {0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+	rle = header[2] == 10;
+	return memcmp(TGAheader, header, 2) == 0 && (header[2] == 2 || rle) && memcmp(TGAheader + 3, header + 3, 9) == 0;
+}
+
+bool Image::readTGAPixels(FILE* file, bool rle, unsigned char* data, unsigned int num_pixels, unsigned int bytes_per_pixel)
+{
+	size_t size = (size_t)num_pixels * bytes_per_pixel;
+	if (!rle)
+		return fread(data, 1, size, file) == size;
+
+	//the rest of the file is read at once and decoded in a single pass
+	long start = ftell(file);
+	fseek(file, 0, SEEK_END);
+	long end = ftell(file);
+	fseek(file, start, SEEK_SET);
+	if (end <= start)
+		return false;
+	std::vector<unsigned char> packed(end - start);
+	if (fread(&packed[0], 1, packed.size(), file) != packed.size())
+		return false;
+
+	//every packet starts with a byte: the high bit says if it is a run (one pixel repeated) or raw pixels, the other 7 bits are the count - 1
+	const unsigned char* src = &packed[0];
+	const unsigned char* src_end = src + packed.size();
+	unsigned char* dst = data;
+	unsigned char* dst_end = data + size;
+	while (dst < dst_end)
+	{
+		if (src >= src_end)
+			return false;
+		bool run = (*src & 0x80) != 0;
+		size_t bytes = ((*src & 0x7F) + 1) * bytes_per_pixel;
+		src++;
+		if (bytes > (size_t)(dst_end - dst))
+			return false; //corrupted, more pixels than the image has
+
+		if (run)
+		{
+			if ((size_t)(src_end - src) < bytes_per_pixel)
+				return false;
+			if (bytes_per_pixel == 4)
+			{
+				unsigned int pixel;
+				memcpy(&pixel, src, 4);
+				for (unsigned char* p = dst; p < dst + bytes; p += 4)
+					memcpy(p, &pixel, 4);
+			}
+			else
+			{
+				for (unsigned char* p = dst; p < dst + bytes; p += 3)
+				{
+					p[0] = src[0];
+					p[1] = src[1];
+					p[2] = src[2];
+				}
+			}
+			src += bytes_per_pixel;
+		}
+		else
+		{
+			if ((size_t)(src_end - src) < bytes)
+				return false;
+			memcpy(dst, src, bytes);
+			src += bytes;
+		}
+		dst += bytes;
+	}
+	return true;
+}
+
+//appends a row of BGR pixels as RLE packets, runs of 2 or more equal pixels are stored once. Packets never cross rows, as the format asks
+static void encodeTGARow(const unsigned char* row, unsigned int num_pixels, std::vector<unsigned char>& out)
+{
+	unsigned int i = 0;
+	while (i < num_pixels)
+	{
+		unsigned int count = 1;
+		while (i + count < num_pixels && count < 128 && memcmp(row + (i + count) * 3, row + i * 3, 3) == 0)
+			count++;
+		if (count > 1)
+		{
+			out.push_back(0x80 | (count - 1));
+			out.insert(out.end(), row + i * 3, row + i * 3 + 3);
+			i += count;
+			continue;
+		}
+
+		//raw pixels until two equal ones start a run
+		while (i + count < num_pixels && count < 128 && !(i + count + 1 < num_pixels && memcmp(row + (i + count) * 3, row + (i + count + 1) * 3, 3) == 0))
+			count++;
+		out.push_back(count - 1);
+		out.insert(out.end(), row + i * 3, row + (i + count) * 3);
+		i += count;
+	}
+}
+
 bool Image::loadTGA(const char* filename)
 {
-	unsigned char TGAheader[12] = {0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0};
 	unsigned char TGAcompare[12];
+	bool rle;
 	unsigned char header[6];
 	unsigned int bytesPerPixel;
 	unsigned int imageSize;
@@ -131,7 +232,7 @@ bool Image::loadTGA(const char* filename)
 
 	FILE * file = fopen( sfullPath.c_str(), "rb");
    	if ( file == NULL || fread(TGAcompare, 1, sizeof(TGAcompare), file) != sizeof(TGAcompare) ||
-		memcmp(TGAheader, TGAcompare, sizeof(TGAheader)) != 0 ||
+		!checkTGAHeader(TGAcompare, rle) ||
 		fread(header, 1, sizeof(header), file) != sizeof(header))
 	{
 		std::cerr << "File not found: " << sfullPath.c_str() << std::endl;
@@ -162,7 +263,7 @@ bool Image::loadTGA(const char* filename)
     
 	tgainfo->data = new unsigned char[imageSize];
     
-	if (tgainfo->data == NULL || fread(tgainfo->data, 1, imageSize, file) != imageSize)
+	if (tgainfo->data == NULL || !readTGAPixels(file, rle, tgainfo->data, tgainfo->width * tgainfo->height, bytesPerPixel))
 	{
 		if (tgainfo->data != NULL)
 			delete tgainfo->data;
@@ -197,9 +298,11 @@ bool Image::loadTGA(const char* filename)
 }
 
 // Saves the image to a TGA file
-bool Image::saveTGA(const char* filename)
+bool Image::saveTGA(const char* filename, bool rle)
 {
 	unsigned char TGAheader[12] = {0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+	if (rle)
+		TGAheader[2] = 10;
 
 	FILE *file = fopen(filename, "wb");
 	if ( file == NULL )
@@ -233,7 +336,18 @@ bool Image::saveTGA(const char* filename)
 			bytes[pos] = c.b;
 		}
 
-	fwrite(bytes, 1, width*height*3, file);
+	if (rle)
+	{
+		std::vector<unsigned char> packed;
+		packed.reserve(width*height*3);
+		for(unsigned int y = 0; y < height; ++y)
+			encodeTGARow(bytes + y*width*3, width, packed);
+		if (packed.size())
+			fwrite(&packed[0], 1, packed.size(), file);
+	}
+	else
+		fwrite(bytes, 1, width*height*3, file);
+	delete[] bytes;
 	fclose(file);
 	return true;
 }
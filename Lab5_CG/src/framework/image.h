@@ -69,9 +69,13 @@ public:
 	//returns a new image with the area from (startx,starty) of size width,height
 	Image getArea(unsigned int start_x, unsigned int start_y, unsigned int width, unsigned int height);
 
-	//save or load images from the hard drive
+	//save or load images from the hard drive, they can be uncompressed or RLE TGAs
 	bool loadTGA(const char* filename);
-	bool saveTGA(const char* filename);
+	bool saveTGA(const char* filename, bool rle = false);
+
+	//TGA parts shared with the texture loader: the 12 first bytes of the header and the pixels after it
+	static bool checkTGAHeader(const unsigned char* header, bool& rle);
+	static bool readTGAPixels(FILE* file, bool rle, unsigned char* data, unsigned int num_pixels, unsigned int bytes_per_pixel);
 
 	//used to easy code
 	#ifndef IGNORE_LAMBDAS
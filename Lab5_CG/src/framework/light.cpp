@@ -1,4 +1,5 @@
 #include "light.h"
+#include "shader.h"
 
 
 
@@ -7,6 +8,25 @@ Light::Light()
 	position.set(50, 50, 0);
 	diffuse_color.set(1.0f,0.0f,0.0f);
 	specular_color.set(1.0f, 0.5f, 0.0f);
+	block = NULL;
+}
+
+Light::~Light()
+{
+	delete block;
+}
+
+void Light::bind()
+{
+	if (!block)
+		block = new UniformBuffer("LightBlock", UNIFORM_BLOCK_LIGHT);
+
+	LightBlock values = LightBlock(); //value initialized, so the padding is zero
+	values.position = position;
+	values.diffuse_color = diffuse_color;
+	values.specular_color = specular_color;
+	block->upload(&values, sizeof(values));
+	block->bind();
 }
 
 
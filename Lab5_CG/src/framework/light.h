@@ -2,6 +2,16 @@
 
 #include "framework.h"
 
+class UniformBuffer;
+
+//the light in the layout of the LightBlock uniform block (std140, every vec3 is padded to 16 bytes)
+typedef struct sLightBlock
+{
+	Vector3 position; float pad0;
+	Vector3 diffuse_color; float pad1;
+	Vector3 specular_color; float pad2;
+} LightBlock;
+
 //This class contains all the info about the properties of the light
 class Light
 {
@@ -11,8 +21,15 @@ public:
 	Vector3 specular_color; //the amount (and color) of specular
 
 	Light();
+	~Light();
+
+	//uploads the properties to its LightBlock buffer (only if they changed) and makes the shaders read it
+	void bind();
+
+private:
+	UniformBuffer* block; //created the first time it is bound, when there is a GL context
 
-	//possible method: uploads properties to shader uniforms
-	//void uploadToShader(Shader* shader);
+	Light(const Light& c); //it owns the buffer, it can not be copied
+	Light& operator = (const Light& c);
 };
 
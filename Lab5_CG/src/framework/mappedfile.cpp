@@ -0,0 +1,112 @@
+#include "mappedfile.h"
+
+#ifdef WIN32
+	#include <windows.h>
+#else
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+
+MappedFile::MappedFile()
+{
+	data = NULL;
+	size = 0;
+#ifdef WIN32
+	file = NULL;
+	mapping = NULL;
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+bool MappedFile::open(const char* filename)
+{
+	close();
+
+#ifdef WIN32
+	HANDLE handle = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (handle == INVALID_HANDLE_VALUE)
+		return false;
+	file = handle;
+
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(handle, &file_size))
+	{
+		close();
+		return false;
+	}
+	size = (size_t)file_size.QuadPart;
+	if (size == 0)
+	{
+		data = ""; //windows can not map empty files
+		return true;
+	}
+
+	mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping == NULL)
+	{
+		close();
+		return false;
+	}
+	data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+	int fd = ::open(filename, O_RDONLY);
+	if (fd == -1)
+		return false;
+
+	struct stat info;
+	if (fstat(fd, &info) == -1)
+	{
+		::close(fd);
+		return false;
+	}
+	size = (size_t)info.st_size;
+	if (size == 0)
+	{
+		::close(fd);
+		data = ""; //mmap does not take empty files
+		return true;
+	}
+
+	void* view = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd); //the mapping keeps its own reference to the file
+	if (view == MAP_FAILED)
+	{
+		size = 0;
+		return false;
+	}
+	madvise(view, size, MADV_SEQUENTIAL); //we read it from start to end
+	data = (const char*)view;
+#endif
+
+	if (data == NULL)
+	{
+		close();
+		return false;
+	}
+	return true;
+}
+
+void MappedFile::close()
+{
+#ifdef WIN32
+	if (data && size)
+		UnmapViewOfFile(data);
+	if (mapping)
+		CloseHandle(mapping);
+	if (file)
+		CloseHandle(file);
+	mapping = NULL;
+	file = NULL;
+#else
+	if (data && size)
+		munmap((void*)data, size);
+#endif
+	data = NULL;
+	size = 0;
+}
@@ -0,0 +1,32 @@
+/*  Read only view of a whole file mapped in memory, so big files (like meshes) can be parsed in place without copying them.
+	It uses mmap in linux and mac and a file mapping in windows.
+*/
+
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <cstddef>
+
+class MappedFile
+{
+public:
+	const char* data; //content of the file, it is NOT null terminated
+	size_t size;
+
+	MappedFile();
+	~MappedFile();
+
+	bool open(const char* filename);
+	void close();
+
+private:
+#ifdef WIN32
+	void* file;
+	void* mapping;
+#endif
+
+	MappedFile(const MappedFile& c);
+	MappedFile& operator = (const MappedFile& c);
+};
+
+#endif
@@ -1,4 +1,5 @@
 #include "material.h"
+#include "shader.h"
 
 
 
@@ -8,6 +9,26 @@ Material::Material()
 	diffuse.set(1, 1, 1); //reflected diffuse light
 	specular.set(1, 1, 1); //reflected specular light
 	shininess = 30.0; //glosiness coefficient (plasticity)
+	block = NULL;
+}
+
+Material::~Material()
+{
+	delete block;
+}
+
+void Material::bind()
+{
+	if (!block)
+		block = new UniformBuffer("MaterialBlock", UNIFORM_BLOCK_MATERIAL);
+
+	MaterialBlock values = MaterialBlock();
+	values.ambient = ambient;
+	values.diffuse = diffuse;
+	values.specular = specular;
+	values.shininess = shininess;
+	block->upload(&values, sizeof(values));
+	block->bind();
 }
 
 
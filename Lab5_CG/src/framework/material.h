@@ -2,6 +2,17 @@
 
 #include "framework.h"
 
+class UniformBuffer;
+
+//the material in the layout of the MaterialBlock uniform block (std140, the shininess fills the padding of the last vec3)
+typedef struct sMaterialBlock
+{
+	Vector3 ambient; float pad0;
+	Vector3 diffuse; float pad1;
+	Vector3 specular;
+	float shininess;
+} MaterialBlock;
+
 class Material
 {
 public:
@@ -12,6 +23,16 @@ public:
 	float shininess; //glosiness coefficient (plasticity)
 
 	Material();
-	
+	~Material();
+
+	//uploads the properties to its own MaterialBlock buffer (only if they changed) and makes the shaders read it,
+	//so drawing with another material only changes which buffer is bound
+	void bind();
+
+private:
+	UniformBuffer* block; //created the first time it is bound, when there is a GL context
+
+	Material(const Material& c); //it owns the buffer, it can not be copied
+	Material& operator = (const Material& c);
 };
 
@@ -10,19 +10,80 @@
 #include "camera.h"
 #include "image.h"
 
+//big OBJ files are parsed by several threads, each one taking at least this many bytes
+#define OBJ_MIN_CHUNK_SIZE (256 * 1024)
+//vertices kept by the post-transform cache the triangle order is optimized for
+#define MESH_VERTEX_CACHE_SIZE 32
+
+class Shader;
+
+//a per instance attribute for Mesh::renderInstanced: its name in the shader, number of floats (16 for a mat4) and offset in bytes inside the data of an instance
+typedef struct sInstanceAttribute
+{
+	const char* name;
+	int size;
+	int offset;
+} InstanceAttribute;
+
 class Mesh
 {
 public:
 	std::vector< Vector3 > vertices; //here we store the vertices
 	std::vector< Vector3 > normals;	 //here we store the normals
 	std::vector< Vector2 > uvs;	 //here we store the texture coordinates
+	std::vector< unsigned int > indices; //three per triangle, if empty every three vertices are a triangle
+
+	//bounding volumes of the vertices in local space, for the frustum culling. The loaders compute them, call computeBounds after changing the vertices by hand
+	Vector3 aabb_min;
+	Vector3 aabb_max;
+	Vector3 center; //of the box and of the bounding sphere
+	float radius;
+
+	//copies of the arrays in VRAM (one VBO per array) and the VAO that remembers how they are bound.
+	//They are uploaded the first time the mesh is rendered and again only when it is marked as dirty
+	GLuint vertices_vbo_id;
+	GLuint normals_vbo_id;
+	GLuint uvs_vbo_id;
+	GLuint indices_vbo_id;
+	GLuint instances_vbo_id; //instance data of the last renderInstanced, it is uploaded every call
+	GLuint vao_id;
+	bool dirty; //the arrays changed since the last upload
 
 	Mesh();
+	~Mesh();
 	void clear();
-	void render(int primitive); //TODO
+	void render(int primitive); //only binds the VAO (or the VBOs) and draws
+	//draws num_instances copies with one call (the shader must be enabled). instance_data has stride bytes per instance
+	//with the attributes described in attributes. Without instancing support it falls back to one draw per instance
+	void renderInstanced(int primitive, Shader* shader, const void* instance_data, int stride, int num_instances, const InstanceAttribute* attributes, int num_attributes);
+
+	void markDirty() { dirty = true; } //call it after changing the arrays by hand
+	void computeBounds();
+	void uploadToVRAM();
+	void releaseVRAM();
 
 	void createPlane(float size);
+	//loads the file as an indexed mesh (the vertices repeated in several faces are stored only once).
+	//It uses one thread per core for big files and keeps a binary copy (filename.mbin) to load it faster next time
 	bool loadOBJ(const char* filename);
+
+	//binary mesh files, they are loaded with a single copy of every array. If source is given the binary
+	//remembers that file and loadBIN fails when the source has changed since it was saved
+	bool loadBIN(const char* filename, const char* source = NULL);
+	bool saveBIN(const char* filename, const char* source = NULL);
+
+	//reorders the triangles so their vertices are reused while they are still in the post-transform cache (Forsyth's algorithm),
+	//then the vertices in the order the triangles use them. loadOBJ already does it, only for indexed meshes
+	void optimizeVertexCache();
+	//average vertices transformed per triangle (ACMR) and per vertex (ATVR) with a FIFO cache of cache_size vertices
+	void computeVertexCacheStats(int cache_size, float& acmr, float& atvr);
+
+private:
+	void bindVertexArrays();
+	void unbindVertexArrays();
+
+	Mesh(const Mesh& c); //it owns GL objects, it can not be copied
+	Mesh& operator = (const Mesh& c);
 };
 
 
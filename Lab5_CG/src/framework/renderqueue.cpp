@@ -0,0 +1,196 @@
+#include "renderqueue.h"
+#include "mesh.h"
+#include "texture.h"
+#include "material.h"
+#include "camera.h"
+
+#include <algorithm>
+#include <cstddef>
+
+#define RENDER_QUEUE_MAX_INDEX 0xFFFF //the key has 16 bits for every part, from there on they share the index (they are still drawn right, only not grouped)
+
+//layout of DrawInstance for the attributes of the instanced shaders (like phong_3_instanced.vs)
+const InstanceAttribute draw_instance_attributes[] = {
+	{ "i_model", 16, offsetof(DrawInstance, model) },
+	{ "i_material_ambient", 3, offsetof(DrawInstance, material_ambient) },
+	{ "i_material_diffuse", 3, offsetof(DrawInstance, material_diffuse) },
+	{ "i_material_specular", 3, offsetof(DrawInstance, material_specular) },
+	{ "i_material_shininess", 1, offsetof(DrawInstance, material_shininess) },
+};
+
+//index of the key in the map, a new one if it is not there
+template <typename T> static int getIndex(std::map<T, int>& indices, const T& key)
+{
+	typename std::map<T, int>::iterator it = indices.find(key);
+	if (it != indices.end())
+		return it->second;
+	int index = std::min((int)indices.size(), RENDER_QUEUE_MAX_INDEX);
+	indices[key] = index;
+	return index;
+}
+
+static bool compareKeys(const DrawItem& a, const DrawItem& b)
+{
+	return a.key < b.key;
+}
+
+RenderQueue::RenderQueue()
+{
+	memset(&stats, 0, sizeof(stats));
+	uniform_model = Shader::GetUniformId("model");
+	uniform_textures[0] = Shader::GetUniformId("color_texture");
+	uniform_textures[1] = Shader::GetUniformId("normal_texture");
+}
+
+void RenderQueue::submit(Mesh* mesh, Shader* shader, Material* material, const Matrix44& model, Texture* color_texture, Texture* normal_texture, GLenum cull_face)
+{
+	DrawItem item;
+	item.mesh = mesh;
+	item.shader = shader;
+	item.textures[0] = color_texture;
+	item.textures[1] = normal_texture;
+	item.material = material;
+	item.model = model;
+	item.cull_face = cull_face;
+	item.key = 0;
+	items.push_back(item);
+}
+
+int RenderQueue::getShaderIndex(Shader* shader)
+{
+	int index = getIndex(shader_indices, (const void*)shader);
+	if (index >= (int)instanced.size())
+	{
+		instanced.resize(index + 1);
+		instanced[index] = shader->getAttribLocation(draw_instance_attributes[0].name) != -1;
+	}
+	return index;
+}
+
+void RenderQueue::flush(Camera* camera)
+{
+	memset(&stats, 0, sizeof(stats));
+	stats.items = items.size();
+
+	for (size_t i = 0; i < items.size(); ++i)
+	{
+		DrawItem& item = items[i];
+		unsigned long long shader_index = getShaderIndex(item.shader);
+		unsigned long long texture_index = getIndex(texture_indices, std::make_pair((const void*)item.textures[0], (const void*)item.textures[1]));
+		unsigned long long material_index = instanced[shader_index] ? getIndex(mesh_indices, (const void*)item.mesh) : getIndex(material_indices, (const void*)item.material);
+
+		Vector3 position(item.model.m[12], item.model.m[13], item.model.m[14]);
+		float distance = (position - camera->eye).length() / camera->far_plane;
+		unsigned long long depth = (unsigned long long)(clamp(distance, 0.0f, 1.0f) * RENDER_QUEUE_MAX_INDEX);
+
+		item.key = (shader_index << 48) | (texture_index << 32) | (material_index << 16) | depth;
+	}
+	std::stable_sort(items.begin(), items.end(), compareKeys);
+
+	Shader* shader = NULL;
+	Texture* textures[RENDER_QUEUE_MAX_TEXTURES] = { NULL, NULL };
+	Material* material = NULL;
+	GLenum cull_face = 0;
+	glDisable(GL_CULL_FACE);
+	size_t i = 0;
+	while (i < items.size())
+	{
+		DrawItem& item = items[i];
+
+		bool shader_changed = item.shader != shader;
+		if (shader_changed)
+		{
+			shader = item.shader;
+			shader->enable();
+			stats.shader_changes++;
+		}
+
+		//a new program also needs its samplers set, even with the same textures
+		if (shader_changed || memcmp(textures, item.textures, sizeof(textures)) != 0)
+		{
+			for (int t = 0; t < RENDER_QUEUE_MAX_TEXTURES; ++t)
+				if (item.textures[t])
+					shader->setTexture(uniform_textures[t], item.textures[t], t);
+			memcpy(textures, item.textures, sizeof(textures));
+			stats.texture_changes++;
+		}
+
+		if (item.cull_face != cull_face)
+		{
+			if (item.cull_face)
+			{
+				if (!cull_face)
+					glEnable(GL_CULL_FACE);
+				glCullFace(item.cull_face);
+			}
+			else
+				glDisable(GL_CULL_FACE);
+			cull_face = item.cull_face;
+			stats.cull_changes++;
+		}
+
+		size_t last = i + 1;
+		if (instanced[item.key >> 48])
+		{
+			while (last < items.size() && items[last].shader == shader && items[last].mesh == item.mesh && memcmp(items[last].textures, textures, sizeof(textures)) == 0 && items[last].cull_face == cull_face)
+				last++;
+			renderBatch(i, last);
+		}
+		else
+		{
+			if (item.material && item.material != material)
+			{
+				material = item.material;
+				material->bind();
+				stats.material_changes++;
+			}
+			shader->setMatrix44(uniform_model, item.model);
+			item.mesh->render(GL_TRIANGLES);
+		}
+		int triangles = (item.mesh->indices.size() ? item.mesh->indices.size() : item.mesh->vertices.size()) / 3 * (last - i);
+		stats.triangles += triangles;
+		if (cull_face)
+			stats.face_culling_triangles += triangles;
+		stats.calls++;
+		i = last;
+	}
+
+	if (shader)
+		shader->disable();
+	if (cull_face)
+		glDisable(GL_CULL_FACE); //the rest of the frame draws both faces, as before the flush
+
+	items.clear();
+	shader_indices.clear();
+	texture_indices.clear();
+	material_indices.clear();
+	mesh_indices.clear();
+	instanced.clear();
+}
+
+void RenderQueue::renderBatch(size_t first, size_t last)
+{
+	instances.resize(last - first);
+	for (size_t i = first; i < last; ++i)
+	{
+		const DrawItem& item = items[i];
+		DrawInstance& instance = instances[i - first];
+		instance.model = item.model;
+		if (item.material)
+		{
+			instance.material_ambient = item.material->ambient;
+			instance.material_diffuse = item.material->diffuse;
+			instance.material_specular = item.material->specular;
+			instance.material_shininess = item.material->shininess;
+		}
+		else
+		{
+			instance.material_ambient = Vector3();
+			instance.material_diffuse = Vector3();
+			instance.material_specular = Vector3();
+			instance.material_shininess = 0.0f;
+		}
+	}
+
+	items[first].mesh->renderInstanced(GL_TRIANGLES, items[first].shader, &instances[0], sizeof(DrawInstance), instances.size(), draw_instance_attributes, sizeof(draw_instance_attributes) / sizeof(InstanceAttribute));
+}
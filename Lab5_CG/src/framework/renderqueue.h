@@ -0,0 +1,87 @@
+/*  Collects the draws of a frame, sorts them so the GL state changes as few times as possible and renders them.
+	Draws with a shader that reads the model and material as instance attributes (i_model, i_material_*) and the same mesh and textures are batched in one instanced call.
+*/
+
+#ifndef RENDERQUEUE_H
+#define RENDERQUEUE_H
+
+#include "includes.h"
+#include "framework.h"
+#include "shader.h"
+
+class Mesh;
+class Texture;
+class Material;
+class Camera;
+
+#define RENDER_QUEUE_MAX_TEXTURES 2 //bound to the slots 0 (color_texture) and 1 (normal_texture)
+
+//a draw submitted to the queue
+typedef struct sDrawItem
+{
+	Mesh* mesh;
+	Shader* shader;
+	Texture* textures[RENDER_QUEUE_MAX_TEXTURES]; //NULL if the slot is not used
+	Material* material;
+	Matrix44 model;
+	GLenum cull_face; //GL_BACK or GL_FRONT for the faces the GPU discards before rasterizing, 0 to draw both
+
+	//sort key: 16 bits for the shader, the textures, the material and the depth, from the highest to the lowest.
+	//With instanced shaders the material goes in the instance data, so the mesh takes its place and the draws of a batch end up together
+	unsigned long long key;
+} DrawItem;
+
+//what the instanced shaders read from every draw of a batch
+typedef struct sDrawInstance
+{
+	Matrix44 model;
+	Vector3 material_ambient;
+	Vector3 material_diffuse;
+	Vector3 material_specular;
+	float material_shininess;
+} DrawInstance;
+
+//what the last flush did (press I to print it)
+typedef struct sRenderQueueStats
+{
+	int items; //draws submitted
+	int calls; //draw calls issued, less than items when they are batched
+	int shader_changes;
+	int texture_changes;
+	int material_changes;
+	int cull_changes;
+	int triangles; //of all the draws
+	int face_culling_triangles; //of the draws with face culling on. Not a count of the culled ones, the GPU does not report it
+} RenderQueueStats;
+
+class RenderQueue
+{
+public:
+	std::vector<DrawItem> items; //submitted since the last flush
+	RenderQueueStats stats;
+
+	RenderQueue();
+
+	void submit(Mesh* mesh, Shader* shader, Material* material, const Matrix44& model, Texture* color_texture = NULL, Texture* normal_texture = NULL, GLenum cull_face = GL_BACK);
+
+	//sorts the items (opaque, so the nearest to the camera first), renders them and empties the queue
+	void flush(Camera* camera);
+
+private:
+	UniformId uniform_model;
+	UniformId uniform_textures[RENDER_QUEUE_MAX_TEXTURES];
+
+	//small indices of the shaders, texture pairs, materials and meshes of the current frame, for the sort key
+	std::map<const void*, int> shader_indices;
+	std::map<std::pair<const void*, const void*>, int> texture_indices;
+	std::map<const void*, int> material_indices;
+	std::map<const void*, int> mesh_indices;
+	std::vector<char> instanced; //per shader index, if it takes the model as an instance attribute
+
+	std::vector<DrawInstance> instances;
+
+	int getShaderIndex(Shader* shader);
+	void renderBatch(size_t first, size_t last); //items[first, last) share shader, textures, mesh and cull face
+};
+
+#endif
@@ -1,5 +1,6 @@
 #include "shader.h"
 #include "utils.h"
+#include "mappedfile.h"
 #include <cassert>
 #include <iostream>
 
@@ -36,6 +37,18 @@ REGISTER_GLEXT( void, glUniform2fvARB, GLint location, GLsizei count, const GLfl
 REGISTER_GLEXT( void, glUniform3fvARB, GLint location, GLsizei count, const GLfloat *value)
 REGISTER_GLEXT( void, glUniform4fvARB, GLint location, GLsizei count, const GLfloat *value)
 REGISTER_GLEXT( void, glUniformMatrix4fvARB, GLint location, GLsizei count, GLboolean transpose, const GLfloat *value )
+REGISTER_GLEXT( GLuint, glGetUniformBlockIndex, GLuint program, const GLchar *uniformBlockName )
+REGISTER_GLEXT( void, glUniformBlockBinding, GLuint program, GLuint uniformBlockIndex, GLuint uniformBlockBinding )
+REGISTER_GLEXT( void, glGenBuffers, GLsizei n, GLuint *buffers )
+REGISTER_GLEXT( void, glDeleteBuffers, GLsizei n, const GLuint *buffers )
+REGISTER_GLEXT( void, glBindBuffer, GLenum target, GLuint buffer )
+REGISTER_GLEXT( void, glBindBufferBase, GLenum target, GLuint index, GLuint buffer )
+REGISTER_GLEXT( void, glBufferData, GLenum target, GLsizeiptr size, const void *data, GLenum usage )
+REGISTER_GLEXT( void, glBufferSubData, GLenum target, GLintptr offset, GLsizeiptr size, const void *data )
+REGISTER_GLEXT( void, glGetProgramiv, GLuint program, GLenum pname, GLint *params )
+REGISTER_GLEXT( void, glProgramParameteri, GLuint program, GLenum pname, GLint value )
+REGISTER_GLEXT( void, glGetProgramBinary, GLuint program, GLsizei bufSize, GLsizei *length, GLenum *binaryFormat, void *binary )
+REGISTER_GLEXT( void, glProgramBinary, GLuint program, GLenum binaryFormat, const void *binary, GLsizei length )
 #else
 #define glCreateProgramObjectARB glCreateProgram
 #define glLinkProgramARB glLinkProgram
@@ -81,8 +94,44 @@ REGISTER_GLEXT( void, glUniformMatrix4fvARB, GLint location, GLsizei count, GLbo
 #define GL_FRAGMENT_SHADER_ARB GL_FRAGMENT_SHADER
 #endif
 
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+
+//header of the program binary files, followed by the binary as the driver gave it
+typedef struct sShaderBinHeader
+{
+	char magic[4]; //"SBIN"
+	unsigned int version;
+	unsigned long long key; //see Shader::computeBinaryKey
+	unsigned int format; //binary format of the driver
+	unsigned int size;
+} ShaderBinHeader;
+
+#define SHADER_BIN_VERSION 1
+
 
 std::map<std::string,Shader*> Shader::s_Shaders;
+std::map<std::string,unsigned int> Shader::s_BlockBindings;
+std::deque<std::string> Shader::s_UniformNames;
+std::map<const char*, int, Shader::ltstr> Shader::s_UniformIds;
+
+//location of a uniform that was not asked to GL yet
+#define SHADER_UNRESOLVED_LOCATION -2
+ShaderStats Shader::s_stats = { 0, 0 };
+
+//value of the shadow state when it is not known, so the next call always reaches GL
+#define SHADER_UNKNOWN_STATE 0xFFFFFFFF
+GLuint Shader::s_current_program;
+int Shader::s_active_texture;
+GLuint Shader::s_bound_textures[SHADER_MAX_TEXTURE_UNITS];
+GLuint Shader::s_bound_blocks[SHADER_MAX_BLOCK_BINDINGS];
 bool Shader::s_ready = false;
 
 
@@ -91,6 +140,7 @@ Shader::Shader()
 	if(!Shader::s_ready)
 		Shader::init();
 	compiled = false;
+	program = vs = fs = 0;
 }
 
 Shader::~Shader()
@@ -124,9 +174,20 @@ bool Shader::load(const std::string& vsf, const std::string& psf)
 	//printf("Vertex shader from memory:\n%s\n", vsm.c_str());
 	//printf("Fragment shader from memory:\n%s\n", psm.c_str());
 
+	//the linked program is saved next to the vertex shader, it is used while the sources and the driver are the same
+	std::string binary_path = vs_fullpath + "." + ps_fullpath.substr(ps_fullpath.find_last_of("\\/") + 1) + ".sbin";
+	unsigned long long key = computeBinaryKey(vsm, psm);
+	if (loadBinary(binary_path, key))
+	{
+		printf("Program loaded from %s\n", binary_path.c_str());
+		return true;
+	}
+
 	if (!compileFromMemory(vsm,psm))
 		return false;
 
+	saveBinary(binary_path, key);
+
 	assert (glGetError() == GL_NO_ERROR);
 
 	return true;
@@ -153,6 +214,32 @@ void Shader::ReloadAll()
 	std::cout << "Shaders recompiled" << std::endl;
 }
 
+void Shader::SetUniformBlockBinding(const char* block_name, unsigned int binding)
+{
+	std::map<std::string,unsigned int>::iterator it = s_BlockBindings.find(block_name);
+	if (it != s_BlockBindings.end() && it->second == binding)
+		return;
+	s_BlockBindings[block_name] = binding;
+
+	//the shaders already compiled need it too
+	for( std::map<std::string,Shader*>::iterator it = s_Shaders.begin(); it!=s_Shaders.end();it++)
+		it->second->bindUniformBlocks();
+}
+
+void Shader::bindUniformBlocks()
+{
+	if (!program || !glGetUniformBlockIndex || !glUniformBlockBinding)
+		return;
+
+	for( std::map<std::string,unsigned int>::iterator it = s_BlockBindings.begin(); it!=s_BlockBindings.end();it++)
+	{
+		GLuint index = glGetUniformBlockIndex(program, it->first.c_str());
+		if (index != GL_INVALID_INDEX) //this shader does not use it
+			glUniformBlockBinding(program, index, it->second);
+	}
+	assert (glGetError() == GL_NO_ERROR);
+}
+
 bool Shader::compile()
 {
 	assert(!compiled && "Shader already compiled" );
@@ -228,6 +315,9 @@ bool Shader::compileFromMemory(const std::string& vsm, const std::string& psm)
 		return false;
 	}
 
+	if (glProgramParameteri && glGetProgramBinary)
+		glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE); //so saveBinary can get it
+
 	glLinkProgramARB(program);
 	assert (glGetError() == GL_NO_ERROR);
 
@@ -246,6 +336,8 @@ bool Shader::compileFromMemory(const std::string& vsm, const std::string& psm)
 		return false;
 	}
 
+	bindUniformBlocks();
+
 #ifdef _DEBUG
 	validate();
 #endif
@@ -255,6 +347,97 @@ bool Shader::compileFromMemory(const std::string& vsm, const std::string& psm)
 	return true;
 }
 
+unsigned long long Shader::computeBinaryKey(const std::string& vsm, const std::string& psm)
+{
+	//FNV-1a of both sources and the strings that identify the driver, a binary is only valid for the same ones
+	const char* parts[5] = { vsm.c_str(), psm.c_str(), (const char*)glGetString(GL_VENDOR), (const char*)glGetString(GL_RENDERER), (const char*)glGetString(GL_VERSION) };
+	unsigned long long hash = 0xCBF29CE484222325ULL;
+	for (int i = 0; i < 5; i++)
+	{
+		for (const char* c = parts[i]; c && *c; c++)
+			hash = (hash ^ (unsigned char)*c) * 0x100000001B3ULL;
+		hash = (hash ^ 0xFF) * 0x100000001B3ULL; //separator, so moving text from one part to the next changes the key
+	}
+	return hash;
+}
+
+bool Shader::loadBinary(const std::string& filename, unsigned long long key)
+{
+	if (!glProgramBinary || !glGetProgramiv)
+		return false;
+
+	MappedFile file;
+	if (!file.open(filename.c_str()) || file.size < sizeof(ShaderBinHeader))
+		return false;
+
+	ShaderBinHeader header;
+	memcpy(&header, file.data, sizeof(header));
+	if (memcmp(header.magic, "SBIN", 4) != 0 || header.version != SHADER_BIN_VERSION || header.key != key || file.size != sizeof(header) + header.size)
+		return false;
+
+	program = glCreateProgramObjectARB();
+	vs = fs = 0;
+	glProgramBinary(program, header.format, file.data + sizeof(header), header.size);
+	glGetError(); //a binary the driver does not accept (like after updating it) leaves an error, it is not one for us
+
+	GLint linked = 0;
+	glGetProgramiv(program, GL_LINK_STATUS, &linked);
+	assert(glGetError() == GL_NO_ERROR);
+	if (!linked)
+	{
+		release();
+		return false; //compiled again from the sources
+	}
+
+	bindUniformBlocks();
+	compiled = true;
+	return true;
+}
+
+bool Shader::saveBinary(const std::string& filename, unsigned long long key)
+{
+	if (!glGetProgramBinary || !glGetProgramiv)
+		return false;
+
+	GLint formats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (formats == 0 || length <= 0)
+		return false; //the driver can not give it
+
+	std::vector<char> binary(length);
+	GLsizei written = 0;
+	GLenum format = 0;
+	glGetProgramBinary(program, length, &written, &format, &binary[0]);
+	if (glGetError() != GL_NO_ERROR || written <= 0)
+		return false;
+
+	ShaderBinHeader header;
+	memset(&header, 0, sizeof(header));
+	header.version = SHADER_BIN_VERSION;
+	header.key = key;
+	header.format = format;
+	header.size = written;
+
+	FILE* f = fopen(filename.c_str(), "wb");
+	if (f == NULL)
+		return false;
+
+	//the magic is written last, so a file left half written is never taken as valid
+	bool ok = fwrite(&header, sizeof(header), 1, f) == 1 && fwrite(&binary[0], written, 1, f) == 1;
+	if (ok)
+		ok = fseek(f, 0, SEEK_SET) == 0 && fwrite("SBIN", 4, 1, f) == 1;
+	ok = fclose(f) == 0 && ok;
+
+	if (!ok)
+	{
+		printf("Could not save %s\n", filename.c_str());
+		remove(filename.c_str());
+	}
+	return ok;
+}
+
 bool Shader::validate()
 {
 	glValidateProgramARB(program);
@@ -347,16 +530,30 @@ void Shader::release()
 	{
 		glDeleteObjectARB(program);
 		assert (glGetError() == GL_NO_ERROR);
+		if (s_current_program == program)
+			s_current_program = SHADER_UNKNOWN_STATE;
 		program = 0;
 	}
 
+	uniforms.clear(); //the locations and values belong to the old program, they are asked again to the new one
 	compiled = false;
 }
 
+void Shader::useProgram(GLuint program)
+{
+	if (s_current_program == program)
+	{
+		s_stats.skipped++;
+		return;
+	}
+	glUseProgramObjectARB(program);
+	s_current_program = program;
+	s_stats.issued++;
+}
 
 void Shader::enable()
 {
-	glUseProgramObjectARB(program);
+	useProgram(program);
 	assert (glGetError() == GL_NO_ERROR);
 
 	last_slot = 0;
@@ -365,14 +562,14 @@ void Shader::enable()
 
 void Shader::disable()
 {
-	glUseProgramObjectARB(0);
-	glActiveTexture(GL_TEXTURE0);
+	useProgram(0);
+	setActiveTexture(0);
 	assert (glGetError() == GL_NO_ERROR);
 }
 
 void Shader::disableShaders()
 {
-	glUseProgramObjectARB(0);
+	useProgram(0);
 	assert (glGetError() == GL_NO_ERROR);
 }
 
@@ -401,32 +598,62 @@ void Shader::saveInfoLog(GLuint obj)
 	}
 }
 
-GLint Shader::getLocation(const char* varname,loctable* table)
+UniformId Shader::GetUniformId(const char* varname)
 {
-	if(varname == 0 || table == 0)
-		return 0;
+	std::map<const char*, int, ltstr>::iterator it = s_UniformIds.find(varname);
+	if (it != s_UniformIds.end())
+	{
+		UniformId id = { it->second };
+		return id;
+	}
 
-	GLint loc = 0;
-	loctable* locs = table;
+	UniformId id = { (int)s_UniformNames.size() };
+	s_UniformNames.push_back(varname);
+	s_UniformIds[s_UniformNames.back().c_str()] = id.index;
+	return id;
+}
 
-	loctable::iterator cur = locs->find(varname);
-	
-	if(cur == locs->end()) //not found in the locations table
+Shader::UniformSlot* Shader::getSlot(UniformId id)
+{
+	if (id.index >= (int)uniforms.size())
 	{
-		loc = (GLint)glGetUniformLocationARB(program, varname);
-		if (loc == -1)
-		{
-			return -1;
-		}
-
-		//insert the new value
-		locs->insert(loctable::value_type(varname,loc));
+		UniformSlot unresolved;
+		unresolved.location = SHADER_UNRESOLVED_LOCATION;
+		unresolved.size = 0;
+		uniforms.resize(s_UniformNames.size(), unresolved);
 	}
-	else //found in the table
+
+	UniformSlot& slot = uniforms[id.index];
+	if (slot.location == SHADER_UNRESOLVED_LOCATION)
+		slot.location = (GLint)glGetUniformLocationARB(program, s_UniformNames[id.index].c_str());
+	return &slot;
+}
+
+//finds the uniform and compares the value with the last one uploaded to it.
+//Returns false when the GL call is not needed (the uniform does not exist or it already has that value)
+bool Shader::uniformChanged(UniformId id, const void* value, int size, GLint& loc)
+{
+	UniformSlot* slot = getSlot(id);
+	loc = slot->location;
+	if (loc == -1)
+		return false;
+
+	if (size > SHADER_MAX_UNIFORM_SIZE) //too big to remember (arrays), always sent
 	{
-		loc = (*cur).second;
+		slot->size = 0;
+		s_stats.issued++;
+		return true;
 	}
-	return loc;
+	if (slot->size == size && memcmp(slot->value, value, size) == 0)
+	{
+		s_stats.skipped++;
+		return false;
+	}
+
+	slot->size = size;
+	memcpy(slot->value, value, size);
+	s_stats.issued++;
+	return true;
 }
 
 int Shader::getAttribLocation(const char* varname)
@@ -443,7 +670,7 @@ int Shader::getAttribLocation(const char* varname)
 
 int Shader::getUniformLocation(const char* varname)
 {
-	int loc = getLocation(varname, &locations);
+	int loc = getSlot(GetUniformId(varname))->location;
 	if (loc == -1)
 	{
 		return loc;
@@ -454,176 +681,233 @@ int Shader::getUniformLocation(const char* varname)
 
 void Shader::setTexture(const char* varname, Texture* tex)
 {
-	glActiveTexture(GL_TEXTURE0 + last_slot);
-	glBindTexture(GL_TEXTURE_2D, tex->texture_id);
-	setUniform1(varname, last_slot);
-	last_slot++;
-	glActiveTexture(GL_TEXTURE0 + last_slot);
+	setTexture(varname, tex->texture_id);
 }
 
 void Shader::setTexture(const char* varname, unsigned int tex)
 {
-	glActiveTexture(GL_TEXTURE0 + last_slot);
-	glBindTexture(GL_TEXTURE_2D,tex);
+	bindTexture(last_slot, tex);
 	setUniform1(varname,last_slot);
 	last_slot++;
-	glActiveTexture(GL_TEXTURE0 + last_slot);
 }
 
-void Shader::setTexture(const char* varname, Texture* tex, unsigned int slot)
+void Shader::setTexture(UniformId id, Texture* tex, unsigned int slot)
 {
-	glActiveTexture(GL_TEXTURE0 + slot);
-	glBindTexture(GL_TEXTURE_2D, tex->texture_id);
-	setUniform1(varname, (int)slot);
+	bindTexture(slot, tex->texture_id);
+	setUniform1(id, (int)slot);
 	last_slot++;
-	glActiveTexture(GL_TEXTURE0 + last_slot);
 }
 
-void Shader::setUniform1(const char* varname, int input1)
+void Shader::setActiveTexture(unsigned int slot)
+{
+	if (s_active_texture == (int)slot)
+	{
+		s_stats.skipped++;
+		return;
+	}
+	glActiveTexture(GL_TEXTURE0 + slot);
+	s_active_texture = slot;
+	s_stats.issued++;
+}
+
+void Shader::bindTexture(unsigned int slot, GLuint texture_id)
+{
+	assert(slot < SHADER_MAX_TEXTURE_UNITS);
+	if (s_bound_textures[slot] == texture_id)
+	{
+		s_stats.skipped++;
+		return;
+	}
+	setActiveTexture(slot);
+	glBindTexture(GL_TEXTURE_2D, texture_id);
+	s_bound_textures[slot] = texture_id;
+	s_stats.issued++;
+}
+
+void Shader::bindUniformBuffer(unsigned int binding, GLuint buffer_id)
 {
-	GLint loc = getLocation(varname, &locations);
-	CHECK_SHADER_VAR(loc,varname);
+	assert(binding < SHADER_MAX_BLOCK_BINDINGS);
+	if (s_bound_blocks[binding] == buffer_id)
+	{
+		s_stats.skipped++;
+		return;
+	}
+	glBindBufferBase(GL_UNIFORM_BUFFER, binding, buffer_id);
+	s_bound_blocks[binding] = buffer_id;
+	s_stats.issued++;
+}
+
+void Shader::ForgetState()
+{
+	s_current_program = SHADER_UNKNOWN_STATE;
+	s_active_texture = -1;
+	for (int i = 0; i < SHADER_MAX_TEXTURE_UNITS; i++)
+		s_bound_textures[i] = SHADER_UNKNOWN_STATE;
+	for (int i = 0; i < SHADER_MAX_BLOCK_BINDINGS; i++)
+		s_bound_blocks[i] = SHADER_UNKNOWN_STATE;
+}
+
+void Shader::setUniform1(UniformId id, int input1)
+{
+	int value[1] = { input1 };
+	GLint loc;
+	if (!uniformChanged(id, value, sizeof(value), loc))
+		return;
 	glUniform1iARB(loc, input1);
 	assert (glGetError() == GL_NO_ERROR);
 }
 
-void Shader::setUniform2(const char* varname, int input1, int input2)
+void Shader::setUniform2(UniformId id, int input1, int input2)
 {
-	GLint loc = getLocation(varname, &locations);
-	CHECK_SHADER_VAR(loc,varname);
+	int value[2] = { input1, input2 };
+	GLint loc;
+	if (!uniformChanged(id, value, sizeof(value), loc))
+		return;
 	glUniform2iARB(loc, input1, input2);
 	assert (glGetError() == GL_NO_ERROR);
 }
 
-void Shader::setUniform3(const char* varname, int input1, int input2, int input3)
+void Shader::setUniform3(UniformId id, int input1, int input2, int input3)
 {
-	GLint loc = getLocation(varname, &locations);
-	CHECK_SHADER_VAR(loc,varname);
+	int value[3] = { input1, input2, input3 };
+	GLint loc;
+	if (!uniformChanged(id, value, sizeof(value), loc))
+		return;
 	glUniform3iARB(loc, input1, input2, input3);
 	assert (glGetError() == GL_NO_ERROR);
 }
 
-void Shader::setUniform4(const char* varname, const int input1, const int input2, const int input3, const int input4)
+void Shader::setUniform4(UniformId id, const int input1, const int input2, const int input3, const int input4)
 {
-	GLint loc = getLocation(varname, &locations);
-	CHECK_SHADER_VAR(loc,varname);
+	int value[4] = { input1, input2, input3, input4 };
+	GLint loc;
+	if (!uniformChanged(id, value, sizeof(value), loc))
+		return;
 	glUniform4iARB(loc, input1, input2, input3, input4);
 	assert (glGetError() == GL_NO_ERROR);
 }
 
-void Shader::setUniform1Array(const char* varname, const int* input, const int count)
+void Shader::setUniform1Array(UniformId id, const int* input, const int count)
 {
-	GLint loc = getLocation(varname, &locations);
-	CHECK_SHADER_VAR(loc,varname);
+	GLint loc;
+	if (!uniformChanged(id, input, count * 1 * sizeof(*input), loc))
+		return;
 	glUniform1ivARB(loc,count,input);
 	assert (glGetError() == GL_NO_ERROR);
 }
 
-void Shader::setUniform2Array(const char* varname, const int* input, const int count)
+void Shader::setUniform2Array(UniformId id, const int* input, const int count)
 {
-	GLint loc = getLocation(varname, &locations);
-	CHECK_SHADER_VAR(loc,varname);
+	GLint loc;
+	if (!uniformChanged(id, input, count * 2 * sizeof(*input), loc))
+		return;
 	glUniform2ivARB(loc,count,input);
 	assert (glGetError() == GL_NO_ERROR);
 }
 
-void Shader::setUniform3Array(const char* varname, const int* input, const int count)
+void Shader::setUniform3Array(UniformId id, const int* input, const int count)
 {
-	GLint loc = getLocation(varname, &locations);
-	CHECK_SHADER_VAR(loc,varname);
+	GLint loc;
+	if (!uniformChanged(id, input, count * 3 * sizeof(*input), loc))
+		return;
 	glUniform3ivARB(loc,count,input);
 	assert (glGetError() == GL_NO_ERROR);
 }
 
-void Shader::setUniform4Array(const char* varname, const int* input, const int count)
+void Shader::setUniform4Array(UniformId id, const int* input, const int count)
 {
-	GLint loc = getLocation(varname, &locations);
-	CHECK_SHADER_VAR(loc,varname);
+	GLint loc;
+	if (!uniformChanged(id, input, count * 4 * sizeof(*input), loc))
+		return;
 	glUniform4ivARB(loc,count,input);
 	assert (glGetError() == GL_NO_ERROR);
 }
 
-void Shader::setUniform1(const char* varname, const float input1)
+void Shader::setUniform1(UniformId id, const float input1)
 {
-	GLint loc = getLocation(varname, &locations);
-	CHECK_SHADER_VAR(loc,varname);
+	float value[1] = { input1 };
+	GLint loc;
+	if (!uniformChanged(id, value, sizeof(value), loc))
+		return;
 	glUniform1fARB(loc, input1);
 	assert (glGetError() == GL_NO_ERROR);
 }
 
-void Shader::setUniform2(const char* varname, const float input1, const float input2)
+void Shader::setUniform2(UniformId id, const float input1, const float input2)
 {
-	GLint loc = getLocation(varname, &locations);
-	CHECK_SHADER_VAR(loc,varname);
+	float value[2] = { input1, input2 };
+	GLint loc;
+	if (!uniformChanged(id, value, sizeof(value), loc))
+		return;
 	glUniform2fARB(loc, input1, input2);
 	assert (glGetError() == GL_NO_ERROR);
 }
 
-void Shader::setUniform3(const char* varname, const float input1, const float input2, const float input3)
+void Shader::setUniform3(UniformId id, const float input1, const float input2, const float input3)
 {
-	GLint loc = getLocation(varname, &locations);
-	CHECK_SHADER_VAR(loc,varname);
+	float value[3] = { input1, input2, input3 };
+	GLint loc;
+	if (!uniformChanged(id, value, sizeof(value), loc))
+		return;
 	glUniform3fARB(loc, input1, input2, input3);
 	assert (glGetError() == GL_NO_ERROR);
 }
 
-void Shader::setUniform4(const char* varname, const float input1, const float input2, const float input3, const float input4)
+void Shader::setUniform4(UniformId id, const float input1, const float input2, const float input3, const float input4)
 {
-	GLint loc = getLocation(varname, &locations);
-	CHECK_SHADER_VAR(loc,varname);
+	float value[4] = { input1, input2, input3, input4 };
+	GLint loc;
+	if (!uniformChanged(id, value, sizeof(value), loc))
+		return;
 	glUniform4fARB(loc, input1, input2, input3, input4);
 	assert (glGetError() == GL_NO_ERROR);
 }
 
-void Shader::setUniform1Array(const char* varname, const float* input, const int count)
+void Shader::setUniform1Array(UniformId id, const float* input, const int count)
 {
-	GLint loc = getLocation(varname, &locations);
-	CHECK_SHADER_VAR(loc,varname);
+	GLint loc;
+	if (!uniformChanged(id, input, count * 1 * sizeof(*input), loc))
+		return;
 	glUniform1fvARB(loc,count,input);
 	assert (glGetError() == GL_NO_ERROR);
 }
 
-void Shader::setUniform2Array(const char* varname, const float* input, const int count)
+void Shader::setUniform2Array(UniformId id, const float* input, const int count)
 {
-	GLint loc = getLocation(varname, &locations);
-	CHECK_SHADER_VAR(loc,varname);
+	GLint loc;
+	if (!uniformChanged(id, input, count * 2 * sizeof(*input), loc))
+		return;
 	glUniform2fvARB(loc,count,input);
 	assert (glGetError() == GL_NO_ERROR);
 }
 
-void Shader::setUniform3Array(const char* varname, const float* input, const int count)
+void Shader::setUniform3Array(UniformId id, const float* input, const int count)
 {
-	GLint loc = getLocation(varname, &locations);
-	CHECK_SHADER_VAR(loc,varname);
+	GLint loc;
+	if (!uniformChanged(id, input, count * 3 * sizeof(*input), loc))
+		return;
 	glUniform3fvARB(loc,count,input);
 	assert (glGetError() == GL_NO_ERROR);
 }
 
-void Shader::setUniform4Array(const char* varname, const float* input, const int count)
+void Shader::setUniform4Array(UniformId id, const float* input, const int count)
 {
-	GLint loc = getLocation(varname, &locations);
-	CHECK_SHADER_VAR(loc,varname);
+	GLint loc;
+	if (!uniformChanged(id, input, count * 4 * sizeof(*input), loc))
+		return;
 	glUniform4fvARB(loc,count,input);
 	assert (glGetError() == GL_NO_ERROR);
 }
 
-void Shader::setMatrix44(const char* varname, const float* m)
+void Shader::setMatrix44(UniformId id, const float* m)
 {
-	GLint loc = getLocation(varname, &locations);
-	CHECK_SHADER_VAR(loc,varname);
+	GLint loc;
+	if (!uniformChanged(id, m, 16 * sizeof(float), loc))
+		return;
 	glUniformMatrix4fvARB(loc, 1, GL_FALSE, m);
 	assert (glGetError() == GL_NO_ERROR);
 }
 
-void Shader::setMatrix44(const char* varname, const Matrix44 &m)
-{
-	GLint loc = getLocation(varname, &locations);
-	CHECK_SHADER_VAR(loc,varname);
-	glUniformMatrix4fvARB(loc, 1, GL_FALSE, m.m);
-	assert (glGetError() == GL_NO_ERROR);
-}
-
-
 void Shader::init()
 {
 	static bool firsttime = true;
@@ -663,8 +947,63 @@ void Shader::init()
 		IMPORT_GLEXT( glUniform3fvARB );
 		IMPORT_GLEXT( glUniform4fvARB );
 		IMPORT_GLEXT( glUniformMatrix4fvARB );
+		IMPORT_GLEXT( glGetUniformBlockIndex );
+		IMPORT_GLEXT( glUniformBlockBinding );
+		IMPORT_GLEXT( glGenBuffers );
+		IMPORT_GLEXT( glDeleteBuffers );
+		IMPORT_GLEXT( glBindBuffer );
+		IMPORT_GLEXT( glBindBufferBase );
+		IMPORT_GLEXT( glBufferData );
+		IMPORT_GLEXT( glBufferSubData );
+		IMPORT_GLEXT( glGetProgramiv );
+		IMPORT_GLEXT( glProgramParameteri );
+		IMPORT_GLEXT( glGetProgramBinary );
+		IMPORT_GLEXT( glProgramBinary );
 	}
 #endif
+	if(firsttime)
+		ForgetState();
 	
 	firsttime = false;
 }
+
+// ******************************************
+
+UniformBuffer::UniformBuffer(const char* block_name, unsigned int binding)
+{
+	Shader::init();
+
+	this->binding = binding;
+	size = 0;
+	glGenBuffers(1, &buffer_id);
+	Shader::SetUniformBlockBinding(block_name, binding);
+}
+
+UniformBuffer::~UniformBuffer()
+{
+	glDeleteBuffers(1, &buffer_id);
+	Shader::ForgetState(); //it could be bound somewhere, deleting it unbinds it
+}
+
+void UniformBuffer::upload(const void* data, size_t size)
+{
+	if (size == this->size && memcmp(this->data.data(), data, size) == 0)
+		return;
+
+	glBindBuffer(GL_UNIFORM_BUFFER, buffer_id);
+	if (size != this->size)
+		glBufferData(GL_UNIFORM_BUFFER, size, data, GL_DYNAMIC_DRAW);
+	else
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, size, data);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	assert (glGetError() == GL_NO_ERROR);
+
+	this->size = size;
+	this->data.assign((const char*)data, (const char*)data + size);
+}
+
+void UniformBuffer::bind()
+{
+	Shader::bindUniformBuffer(binding, buffer_id);
+	assert (glGetError() == GL_NO_ERROR);
+}
@@ -8,6 +8,7 @@
 #include "includes.h"
 #include <string>
 #include <map>
+#include <deque>
 #include "framework.h"
 #include "texture.h"
 
@@ -18,6 +19,29 @@
 	#define CHECK_SHADER_VAR(a,b) if (a == -1) return
 #endif
 
+//values up to this size (a mat4) are remembered per uniform, so uploading the same value again does not reach GL
+#define SHADER_MAX_UNIFORM_SIZE 64
+#define SHADER_MAX_TEXTURE_UNITS 16
+#define SHADER_MAX_BLOCK_BINDINGS 16
+
+//handle of a uniform name, see Shader::GetUniformId
+typedef struct sUniformId
+{
+	int index;
+} UniformId;
+
+//GL calls issued and skipped because the state was already set, since the last Shader::ResetStats (the application does it every frame)
+typedef struct sShaderStats
+{
+	int issued;
+	int skipped;
+} ShaderStats;
+
+//binding points of the uniform blocks shared by the shaders (std140 layout, see UniformBuffer)
+#define UNIFORM_BLOCK_FRAME 0 //FrameBlock: camera and ambient light, uploaded once per frame
+#define UNIFORM_BLOCK_LIGHT 1 //LightBlock: see Light::bind
+#define UNIFORM_BLOCK_MATERIAL 2 //MaterialBlock: see Material::bind
+
 
 class Shader
 {
@@ -44,39 +68,72 @@ public:
 	static void init();
 	static void disableShaders();
 
+	//shadow copy of the GL state shared by all the programs (current program, active unit, textures and uniform blocks bound)
+	static void bindTexture(unsigned int slot, GLuint texture_id);
+	static void setActiveTexture(unsigned int slot);
+	static void bindUniformBuffer(unsigned int binding, GLuint buffer_id);
+	static void ForgetState(); //call it after changing that state without these functions (like Texture does)
+
+	static ShaderStats s_stats;
+	static void ResetStats() { s_stats.issued = s_stats.skipped = 0; }
+
+	//uniform names are resolved once to a UniformId, valid for every shader and also after ReloadAll.
+	//The setters that take it do not handle any string, the ones with the name look it up every call
+	static UniformId GetUniformId(const char* varname);
+
 	//uniform exist
 	virtual bool IsVar(const char* varname) { return (getUniformLocation(varname) != -1); }
 
 	//upload
 	virtual void setFloat(const char* varname, const float& input) { setUniform1(varname, input); }
 	virtual void setVector3(const char* varname, const Vector3& input) { setUniform3(varname, input.x, input.y, input.z); }
-	virtual void setMatrix44(const char* varname, const float* m);
-	virtual void setMatrix44(const char* varname, const Matrix44 &m);
-
-	virtual void setUniform1Array(const char* varname, const float* input, const int count) ;
-	virtual void setUniform2Array(const char* varname, const float* input, const int count) ;
-	virtual void setUniform3Array(const char* varname, const float* input, const int count) ;
-	virtual void setUniform4Array(const char* varname, const float* input, const int count) ;
-
-	virtual void setUniform1Array(const char* varname, const int* input, const int count) ;
-	virtual void setUniform2Array(const char* varname, const int* input, const int count) ;
-	virtual void setUniform3Array(const char* varname, const int* input, const int count) ;
-	virtual void setUniform4Array(const char* varname, const int* input, const int count) ;
-
-	virtual void setUniform1(const char* varname, const int input1) ;
-	virtual void setUniform2(const char* varname, const int input1, const int input2) ;
-	virtual void setUniform3(const char* varname, const int input1, const int input2, const int input3) ;
-	virtual void setUniform3(const char* varname, const Vector3& input) { setUniform3(varname, input.x, input.y, input.z); }
-	virtual void setUniform4(const char* varname, const int input1, const int input2, const int input3, const int input4) ;
-
-	virtual void setUniform1(const char* varname, const float input) ;
-	virtual void setUniform2(const char* varname, const float input1, const float input2) ;
-	virtual void setUniform3(const char* varname, const float input1, const float input2, const float input3) ;
-	virtual void setUniform4(const char* varname, const float input1, const float input2, const float input3, const float input4) ;
-
+	virtual void setMatrix44(UniformId id, const float* m);
+	virtual void setMatrix44(UniformId id, const Matrix44 &m) { setMatrix44(id, m.m); }
+	virtual void setMatrix44(const char* varname, const float* m) { setMatrix44(GetUniformId(varname), m); }
+	virtual void setMatrix44(const char* varname, const Matrix44 &m) { setMatrix44(GetUniformId(varname), m.m); }
+
+	virtual void setUniform1Array(UniformId id, const float* input, const int count) ;
+	virtual void setUniform2Array(UniformId id, const float* input, const int count) ;
+	virtual void setUniform3Array(UniformId id, const float* input, const int count) ;
+	virtual void setUniform4Array(UniformId id, const float* input, const int count) ;
+	virtual void setUniform1Array(const char* varname, const float* input, const int count) { setUniform1Array(GetUniformId(varname), input, count); }
+	virtual void setUniform2Array(const char* varname, const float* input, const int count) { setUniform2Array(GetUniformId(varname), input, count); }
+	virtual void setUniform3Array(const char* varname, const float* input, const int count) { setUniform3Array(GetUniformId(varname), input, count); }
+	virtual void setUniform4Array(const char* varname, const float* input, const int count) { setUniform4Array(GetUniformId(varname), input, count); }
+
+	virtual void setUniform1Array(UniformId id, const int* input, const int count) ;
+	virtual void setUniform2Array(UniformId id, const int* input, const int count) ;
+	virtual void setUniform3Array(UniformId id, const int* input, const int count) ;
+	virtual void setUniform4Array(UniformId id, const int* input, const int count) ;
+	virtual void setUniform1Array(const char* varname, const int* input, const int count) { setUniform1Array(GetUniformId(varname), input, count); }
+	virtual void setUniform2Array(const char* varname, const int* input, const int count) { setUniform2Array(GetUniformId(varname), input, count); }
+	virtual void setUniform3Array(const char* varname, const int* input, const int count) { setUniform3Array(GetUniformId(varname), input, count); }
+	virtual void setUniform4Array(const char* varname, const int* input, const int count) { setUniform4Array(GetUniformId(varname), input, count); }
+
+	virtual void setUniform1(UniformId id, const int input1) ;
+	virtual void setUniform2(UniformId id, const int input1, const int input2) ;
+	virtual void setUniform3(UniformId id, const int input1, const int input2, const int input3) ;
+	virtual void setUniform4(UniformId id, const int input1, const int input2, const int input3, const int input4) ;
+	virtual void setUniform1(const char* varname, const int input1) { setUniform1(GetUniformId(varname), input1); }
+	virtual void setUniform2(const char* varname, const int input1, const int input2) { setUniform2(GetUniformId(varname), input1, input2); }
+	virtual void setUniform3(const char* varname, const int input1, const int input2, const int input3) { setUniform3(GetUniformId(varname), input1, input2, input3); }
+	virtual void setUniform4(const char* varname, const int input1, const int input2, const int input3, const int input4) { setUniform4(GetUniformId(varname), input1, input2, input3, input4); }
+
+	virtual void setUniform1(UniformId id, const float input) ;
+	virtual void setUniform2(UniformId id, const float input1, const float input2) ;
+	virtual void setUniform3(UniformId id, const float input1, const float input2, const float input3) ;
+	virtual void setUniform3(UniformId id, const Vector3& input) { setUniform3(id, input.x, input.y, input.z); }
+	virtual void setUniform4(UniformId id, const float input1, const float input2, const float input3, const float input4) ;
+	virtual void setUniform1(const char* varname, const float input) { setUniform1(GetUniformId(varname), input); }
+	virtual void setUniform2(const char* varname, const float input1, const float input2) { setUniform2(GetUniformId(varname), input1, input2); }
+	virtual void setUniform3(const char* varname, const float input1, const float input2, const float input3) { setUniform3(GetUniformId(varname), input1, input2, input3); }
+	virtual void setUniform3(const char* varname, const Vector3& input) { setUniform3(GetUniformId(varname), input.x, input.y, input.z); }
+	virtual void setUniform4(const char* varname, const float input1, const float input2, const float input3, const float input4) { setUniform4(GetUniformId(varname), input1, input2, input3, input4); }
+
+	virtual void setTexture(UniformId id, Texture* tex, unsigned int slot);
 	virtual void setTexture(const char* varname, Texture* tex);
 	virtual void setTexture(const char* varname, const unsigned int tex) ;
-	virtual void setTexture(const char* varname, Texture* tex, unsigned int slot = 0);
+	virtual void setTexture(const char* varname, Texture* tex, unsigned int slot = 0) { setTexture(GetUniformId(varname), tex, slot); }
 
 	virtual int getAttribLocation(const char* varname);
 	virtual int getUniformLocation(const char* varname);
@@ -88,6 +145,10 @@ public:
 	static void ReloadAll();
 	static std::map<std::string,Shader*> s_Shaders;
 
+	//every shader with a uniform block of this name reads it from the buffer bound to that binding point (also the ones compiled later)
+	static void SetUniformBlockBinding(const char* block_name, unsigned int binding);
+	static std::map<std::string,unsigned int> s_BlockBindings;
+
 protected:
 
 	bool readFile(const std::string& filename, std::string& content);
@@ -103,6 +164,13 @@ protected:
 	void saveInfoLog(GLuint obj);
 
 	bool validate();
+	void bindUniformBlocks();
+
+	//the linked programs are kept in files (vertex_shader.fragment_shader_name.sbin, next to the vertex shader) so the next
+	//run does not compile them. The key changes with the sources and the driver, and a binary the driver rejects is just compiled again
+	static unsigned long long computeBinaryKey(const std::string& vsm, const std::string& psm);
+	bool loadBinary(const std::string& filename, unsigned long long key);
+	bool saveBinary(const std::string& filename, unsigned long long key);
 
 	GLuint vs;
 	GLuint fs;
@@ -119,12 +187,52 @@ private:
 			return strcmp(s1, s2) < 0;
 		}
 	};	
-	typedef std::map<const char*, int, ltstr> loctable;
 
+	//names of the uniform ids (a deque so the strings never move) and the id of every name
+	static std::deque<std::string> s_UniformNames;
+	static std::map<const char*, int, ltstr> s_UniformIds;
+
+	//location of a uniform in this program and the last value uploaded to it
+	typedef struct sUniformSlot
+	{
+		GLint location; //SHADER_UNRESOLVED_LOCATION until it is asked to GL
+		int size; //bytes in value, 0 if it is not known
+		char value[SHADER_MAX_UNIFORM_SIZE];
+	} UniformSlot;
+	std::vector<UniformSlot> uniforms; //indexed by UniformId
+
+	UniformSlot* getSlot(UniformId id);
+	bool uniformChanged(UniformId id, const void* value, int size, GLint& loc);
+
+	static void useProgram(GLuint program); //glUseProgram skipping the call if it is already in use
+
+	static GLuint s_current_program;
+	static int s_active_texture;
+	static GLuint s_bound_textures[SHADER_MAX_TEXTURE_UNITS];
+	static GLuint s_bound_blocks[SHADER_MAX_BLOCK_BINDINGS];
+
+};
+
+//a buffer in VRAM with the values of a uniform block, so they are uploaded once and shared by all the shaders and draws.
+//The data must follow the std140 layout of the block (a vec3 takes 16 bytes, so it needs a float after it)
+class UniformBuffer
+{
 public:
-	GLint getLocation(const char* varname, loctable* table);
-	loctable locations;	
+	GLuint buffer_id;
+	unsigned int binding;
+	size_t size;
+
+	UniformBuffer(const char* block_name, unsigned int binding);
+	virtual ~UniformBuffer();
+
+	void upload(const void* data, size_t size); //does nothing if the data did not change since the last upload
+	void bind(); //makes the shaders read the block from this buffer
+
+private:
+	std::vector<char> data; //copy of the last upload
 
+	UniformBuffer(const UniformBuffer& c);
+	UniformBuffer& operator = (const UniformBuffer& c);
 };
 
 #endif
\ No newline at end of file
@@ -1,8 +1,17 @@
 #include "texture.h"
 #include "utils.h"
+#include "shader.h"
+#include "image.h"
 
 #include <iostream> //to output
 #include <cmath>
+#include <algorithm>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
 
 
 
@@ -10,17 +19,67 @@
 //function to create mipmaps using the GPU (much faster)
 typedef void (APIENTRY *glGenerateMipmapEXT_func)( GLenum target );
 glGenerateMipmapEXT_func glGenerateMipmapEXT = NULL;
+
+//buffer objects (GL1.5), loaded by Shader::init
+EXTERN_GLEXT( void, glGenBuffers, GLsizei n, GLuint *buffers )
+EXTERN_GLEXT( void, glBindBuffer, GLenum target, GLuint buffer )
+EXTERN_GLEXT( void, glBufferData, GLenum target, GLsizeiptr size, const void *data, GLenum usage )
+REGISTER_GLEXT( void*, glMapBuffer, GLenum target, GLenum access )
+REGISTER_GLEXT( GLboolean, glUnmapBuffer, GLenum target )
 #endif
 
+//pixel buffers for the uploads, used in turns
+static GLuint pbo_ring[TEXTURE_PBO_RING_SIZE];
+static int pbo_next = 0;
+
+std::map<std::string, Texture*> Texture::s_Textures;
+
+//shared with the loader threads: textures waiting to be decoded and the ones decoded waiting to be uploaded
+static std::mutex loader_mutex;
+static std::condition_variable loader_wakeup;
+static std::deque<Texture*> loader_pending;
+static std::deque<Texture*> loader_decoded;
+static std::vector<std::thread> loader_threads;
+static int loader_unfinished = 0;
+static bool loader_stop = false;
+
+//stops the loader threads when the program ends
+static struct sLoaderShutdown
+{
+	~sLoaderShutdown()
+	{
+		{
+			std::lock_guard<std::mutex> lock(loader_mutex);
+			loader_stop = true;
+		}
+		loader_wakeup.notify_all();
+		for (size_t i = 0; i < loader_threads.size(); i++)
+			loader_threads[i].join();
+	}
+} loader_shutdown;
 
 Texture::Texture()
 {
 	width = 0;
 	height = 0;
+	texture_id = 0;
+	loaded = false;
+	mipmaps = true;
+	bytes_per_pixel = 0;
+	decoded = NULL;
 
 #ifndef __APPLE__
 	if(glGenerateMipmapEXT == NULL) //get the extension
 		glGenerateMipmapEXT = (glGenerateMipmapEXT_func) SDL_GL_GetProcAddress("glGenerateMipmapEXT");
+
+	static bool firsttime = true;
+	if(firsttime)
+	{
+		Shader::init();
+		IMPORT_GLEXT( glMapBuffer );
+		IMPORT_GLEXT( glUnmapBuffer );
+		firsttime = false;
+	}
 #endif
 
 }
@@ -37,63 +96,250 @@ bool Texture::load(const char* filename, bool mipmaps)
 			return false;
 
 		this->filename = filename;
+		upload(tgainfo, mipmaps);
+		return true;
+	}
+	else {
+		std::cout << "unsupported texture format: " << ext << " only TGA supported" << std::endl;
+		exit(1);
+	}
+	return false;
+}
+
+//copies the pixels to the next buffer of the ring and leaves it bound, so the glTex*Image calls read from it (with a NULL pointer)
+//and return without waiting for the transfer. False if there are no pixel buffers, then the pixels are given directly
+static bool streamPixels(const void* pixels, size_t size)
+{
+	if (!glMapBuffer || !glUnmapBuffer || !glGenBuffers)
+		return false;
 
-		//How to store a texture in VRAM
+	if (!pbo_ring[0])
+		glGenBuffers(TEXTURE_PBO_RING_SIZE, pbo_ring);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo_ring[pbo_next]);
+	pbo_next = (pbo_next + 1) % TEXTURE_PBO_RING_SIZE;
+
+	//new storage every time: if the GPU is still reading the previous upload the driver gives other memory instead of waiting
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+	void* buffer = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+	if (buffer == NULL)
+	{
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		return false;
+	}
+	memcpy(buffer, pixels, size);
+	glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+	return true;
+}
+
+static void endStreamPixels(bool streamed)
+{
+	if (streamed)
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0); //the other uploads read from client memory
+}
+
+void Texture::upload(TGAInfo* tgainfo, bool mipmaps)
+{
+	//How to store a texture in VRAM
+	if (!loaded)
 		glGenTextures(1, &texture_id); //we need to create an unique ID for the texture
-		glBindTexture(GL_TEXTURE_2D, texture_id);	//we activate this id to tell opengl we are going to use this texture
+	glBindTexture(GL_TEXTURE_2D, texture_id);	//we activate this id to tell opengl we are going to use this texture
+	Shader::ForgetState(); //the texture bound in the active unit changed behind its back
 
-		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);	//set the min filter
-		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,mipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_NEAREST ); //set the mag filter
-		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, 4);
+	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_LINEAR);	//set the min filter
+	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,mipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_NEAREST ); //set the mag filter
+	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, 4);
 
-		if(!mipmaps) //no mipmaps
+	bytes_per_pixel = tgainfo->bpp / 8;
+	bool streamed = streamPixels(tgainfo->data, tgainfo->width * tgainfo->height * bytes_per_pixel);
+	const GLubyte* pixels = streamed ? NULL : tgainfo->data;
+	GLint alignment;
+	glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1); //the buffer holds tightly packed rows, with BGR they may not be a multiple of 4
+
+	if(!mipmaps) //no mipmaps
+	{
+		glTexImage2D(GL_TEXTURE_2D, 0, ( tgainfo->bpp == 24 ? 3 : 4), tgainfo->width, tgainfo->height, 0, ( tgainfo->bpp == 24 ? GL_BGR : GL_BGRA), GL_UNSIGNED_BYTE, pixels); //upload without mipmaps
+	}
+	else
+	{
+		if (glGenerateMipmapEXT) //extension of GL3.0 (I guess faster)
 		{
-			glTexImage2D(GL_TEXTURE_2D, 0, ( tgainfo->bpp == 24 ? 3 : 4), tgainfo->width, tgainfo->height, 0, ( tgainfo->bpp == 24 ? GL_BGR : GL_BGRA), GL_UNSIGNED_BYTE, tgainfo->data); //upload without mipmaps
+			glTexImage2D(GL_TEXTURE_2D, 0, ( tgainfo->bpp == 24 ? 3 : 4), tgainfo->width, tgainfo->height, 0, ( tgainfo->bpp == 24 ? GL_BGR : GL_BGRA), GL_UNSIGNED_BYTE, pixels); //upload without mipmaps
+			this->generateMipmaps(); //glGenerateMipmapEXT(GL_TEXTURE_2D);
 		}
-		else
+		else //use old way
 		{
-			if (glGenerateMipmapEXT) //extension of GL3.0 (I guess faster)
-			{
-				glTexImage2D(GL_TEXTURE_2D, 0, ( tgainfo->bpp == 24 ? 3 : 4), tgainfo->width, tgainfo->height, 0, ( tgainfo->bpp == 24 ? GL_BGR : GL_BGRA), GL_UNSIGNED_BYTE, tgainfo->data); //upload without mipmaps
-				this->generateMipmaps(); //glGenerateMipmapEXT(GL_TEXTURE_2D);
-			}
-			else //use old way
-			{
-				#ifdef GL_VERSION_1_4
-					glTexParameteri( GL_TEXTURE_2D, GL_GENERATE_MIPMAP, GL_TRUE );
-					glTexImage2D(GL_TEXTURE_2D, 0, ( tgainfo->bpp == 24 ? 3 : 4), tgainfo->width, tgainfo->height, 0, ( tgainfo->bpp == 24 ? GL_BGR : GL_BGRA), GL_UNSIGNED_BYTE, tgainfo->data); //upload without mipmaps
-					glTexParameteri( GL_TEXTURE_2D, GL_GENERATE_MIPMAP, GL_FALSE );
-				#else
-					//the wrong and slow way
-					gluBuild2DMipmaps(GL_TEXTURE_2D, ( tgainfo->bpp == 24 ? 3 : 4), tgainfo->width, tgainfo->height, ( tgainfo->bpp == 24 ? GL_BGR : GL_BGRA) , GL_UNSIGNED_BYTE, tgainfo->data); //upload the texture and create their mipmaps
-				#endif
-			}
+			#ifdef GL_VERSION_1_4
+				glTexParameteri( GL_TEXTURE_2D, GL_GENERATE_MIPMAP, GL_TRUE );
+				glTexImage2D(GL_TEXTURE_2D, 0, ( tgainfo->bpp == 24 ? 3 : 4), tgainfo->width, tgainfo->height, 0, ( tgainfo->bpp == 24 ? GL_BGR : GL_BGRA), GL_UNSIGNED_BYTE, pixels); //upload without mipmaps
+				glTexParameteri( GL_TEXTURE_2D, GL_GENERATE_MIPMAP, GL_FALSE );
+			#else
+				//the wrong and slow way (without GL1.4 there are no pixel buffers either, so it is not streamed)
+				gluBuild2DMipmaps(GL_TEXTURE_2D, ( tgainfo->bpp == 24 ? 3 : 4), tgainfo->width, tgainfo->height, ( tgainfo->bpp == 24 ? GL_BGR : GL_BGRA) , GL_UNSIGNED_BYTE, tgainfo->data); //upload the texture and create their mipmaps
+			#endif
 		}
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+	endStreamPixels(streamed);
 
-		width = tgainfo->width;
-		height = tgainfo->height;
+	width = tgainfo->width;
+	height = tgainfo->height;
+	this->mipmaps = mipmaps;
+	loaded = true;
 
-		delete tgainfo->data;
-		delete tgainfo;
-		return true;
+	free(tgainfo->data); //loadTGA allocates it with malloc, it was already copied
+	delete tgainfo;
+}
+
+void Texture::create(int width, int height, bool alpha, bool mipmaps)
+{
+	if (!loaded)
+		glGenTextures(1, &texture_id);
+	glBindTexture(GL_TEXTURE_2D, texture_id);
+	Shader::ForgetState();
+
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, mipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+	glTexImage2D(GL_TEXTURE_2D, 0, alpha ? 4 : 3, width, height, 0, alpha ? GL_BGRA : GL_BGR, GL_UNSIGNED_BYTE, NULL); //storage only
+	if (mipmaps)
+		generateMipmaps();
+
+	this->width = width;
+	this->height = height;
+	this->mipmaps = mipmaps;
+	bytes_per_pixel = alpha ? 4 : 3;
+	loaded = true;
+}
+
+void Texture::updateRect(int x, int y, int w, int h, const void* pixels)
+{
+	if (!loaded || w <= 0 || h <= 0)
+		return; //still the placeholder
+
+	glBindTexture(GL_TEXTURE_2D, texture_id);
+	Shader::ForgetState();
+
+	bool streamed = streamPixels(pixels, w * h * bytes_per_pixel);
+	GLint alignment;
+	glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1); //the rows are tightly packed, with BGR they may not be a multiple of 4
+	glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, w, h, bytes_per_pixel == 3 ? GL_BGR : GL_BGRA, GL_UNSIGNED_BYTE, streamed ? NULL : pixels);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+	endStreamPixels(streamed);
+
+	if (mipmaps)
+		generateMipmaps();
+}
+
+Texture* Texture::Get(const char* filename, bool mipmaps)
+{
+	std::map<std::string, Texture*>::iterator it = s_Textures.find(filename);
+	if (it != s_Textures.end())
+		return it->second;
+
+	Texture* texture = new Texture();
+	texture->filename = filename;
+	texture->mipmaps = mipmaps;
+	texture->texture_id = GetPlaceholder();
+	texture->width = texture->height = 1;
+	s_Textures[filename] = texture;
+
+	std::lock_guard<std::mutex> lock(loader_mutex);
+	if (loader_threads.empty())
+	{
+		int num_threads = std::max(1, std::min((int)std::thread::hardware_concurrency(), TEXTURE_MAX_LOADER_THREADS));
+		for (int i = 0; i < num_threads; i++)
+			loader_threads.push_back(std::thread(LoaderThread));
 	}
-	else {
-		std::cout << "unsupported texture format: " << ext << " only TGA supported" << std::endl;
-		exit(1);
+	loader_pending.push_back(texture);
+	loader_unfinished++;
+	loader_wakeup.notify_one();
+	return texture;
+}
+
+void Texture::LoaderThread()
+{
+	std::unique_lock<std::mutex> lock(loader_mutex);
+	while (true)
+	{
+		loader_wakeup.wait(lock, [] { return loader_stop || !loader_pending.empty(); });
+		if (loader_stop)
+			return;
+		Texture* texture = loader_pending.front();
+		loader_pending.pop_front();
+
+		//only the file reading and decoding is done here, GL can only be used from the thread of the context
+		lock.unlock();
+		TGAInfo* tgainfo = loadTGA(texture->filename.c_str());
+		lock.lock();
+
+		texture->decoded = tgainfo;
+		loader_decoded.push_back(texture);
 	}
-	return false;
+}
+
+void Texture::UploadPending(double max_ms)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	while (true)
+	{
+		Texture* texture;
+		{
+			std::lock_guard<std::mutex> lock(loader_mutex);
+			if (loader_decoded.empty())
+				return;
+			texture = loader_decoded.front();
+			loader_decoded.pop_front();
+			loader_unfinished--;
+		}
+
+		if (texture->decoded)
+		{
+			texture->upload(texture->decoded, texture->mipmaps);
+			texture->decoded = NULL;
+		}
+		else
+			std::cout << "Texture not found: " << texture->filename << std::endl; //it keeps the placeholder
+
+		if (std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() >= max_ms)
+			return;
+	}
+}
+
+int Texture::NumPending()
+{
+	std::lock_guard<std::mutex> lock(loader_mutex);
+	return loader_unfinished;
+}
+
+GLuint Texture::GetPlaceholder()
+{
+	static GLuint placeholder = 0;
+	if (placeholder)
+		return placeholder;
+
+	GLubyte texel[3] = { 255, 128, 128 }; //BGR
+	glGenTextures(1, &placeholder);
+	glBindTexture(GL_TEXTURE_2D, placeholder);
+	Shader::ForgetState();
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexImage2D(GL_TEXTURE_2D, 0, 3, 1, 1, 0, GL_BGR, GL_UNSIGNED_BYTE, texel);
+	return placeholder;
 }
 
 void Texture::bind()
 {
 	glEnable( GL_TEXTURE_2D ); //enable the textures 
 	glBindTexture( GL_TEXTURE_2D, texture_id );	//enable the id of the texture we are going to use
+	Shader::ForgetState();
 }
 
 void Texture::unbind()
 {
 	glDisable( GL_TEXTURE_2D ); //disable the textures 
 	glBindTexture( GL_TEXTURE_2D, 0 );	//disable the id of the texture we are going to use
+	Shader::ForgetState();
 }
 
 void Texture::UnbindAll()
@@ -102,6 +348,7 @@ void Texture::UnbindAll()
 	glDisable( GL_TEXTURE_2D );
 	glBindTexture( GL_TEXTURE_2D, 0 );
 	glBindTexture( GL_TEXTURE_CUBE_MAP, 0 );
+	Shader::ForgetState();
 }
 
 void Texture::generateMipmaps()
@@ -110,12 +357,13 @@ void Texture::generateMipmaps()
 
 	glBindTexture( GL_TEXTURE_2D, texture_id );	//enable the id of the texture we are going to use
 	glGenerateMipmapEXT(GL_TEXTURE_2D);
+	Shader::ForgetState();
 }
 
 Texture::TGAInfo* Texture::loadTGA(const char* filename)
 {
-    GLubyte TGAheader[12] = {0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0};
     GLubyte TGAcompare[12];
+    bool rle; //type 10 instead of 2
     GLubyte header[6];
     GLuint bytesPerPixel;
     GLuint imageSize;
@@ -124,7 +372,7 @@ Texture::TGAInfo* Texture::loadTGA(const char* filename)
     FILE * file = fopen(filename, "rb");
     
     if ( file == NULL || fread(TGAcompare, 1, sizeof(TGAcompare), file) != sizeof(TGAcompare) ||
-        memcmp(TGAheader, TGAcompare, sizeof(TGAheader)) != 0 ||
+        !Image::checkTGAHeader(TGAcompare, rle) ||
         fread(header, 1, sizeof(header), file) != sizeof(header))
     {
         if (file == NULL)
@@ -154,7 +402,7 @@ Texture::TGAInfo* Texture::loadTGA(const char* filename)
     
     tgainfo->data = (GLubyte*)malloc(imageSize);
     
-    if (tgainfo->data == NULL || fread(tgainfo->data, 1, imageSize, file) != imageSize)
+    if (tgainfo->data == NULL || !Image::readTGAPixels(file, rle, tgainfo->data, tgainfo->width * tgainfo->height, bytesPerPixel))
     {
         if (tgainfo->data != NULL)
             free(tgainfo->data);
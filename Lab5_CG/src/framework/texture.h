@@ -8,7 +8,9 @@
 #include <map>
 #include <string>
 
-
+#define TEXTURE_MAX_LOADER_THREADS 4 //threads decoding the files of Texture::Get
+#define TEXTURE_UPLOAD_BUDGET_MS 4.0 //time per frame the application gives to Texture::UploadPending
+#define TEXTURE_PBO_RING_SIZE 4 //pixel buffers used in turns by the uploads, so one can be filled while the GPU copies from the others
 
 // TEXTURE CLASS
 class Texture
@@ -26,6 +28,7 @@ public:
 	float width;
 	float height;
 	std::string filename;
+	bool loaded; //false while Texture::Get is still loading it (or if it failed), texture_id is the placeholder meanwhile
 
 	Texture();
 	void bind();
@@ -35,8 +38,32 @@ public:
 	bool load(const char* filename, bool mipmaps = true);
 	void generateMipmaps();
 
+	//empty texture (BGR or BGRA) to be filled with updateRect, like the pages of a streamed texture
+	void create(int width, int height, bool alpha = true, bool mipmaps = false);
+
+	//replaces a rectangle with pixels (w * h tightly packed, in the BGR or BGRA format of the texture). Like the whole uploads,
+	//they are copied to a pixel buffer so GL transfers them to VRAM without the CPU waiting for it
+	void updateRect(int x, int y, int w, int h, const void* pixels);
+
+	//returns the texture of that file (the same one if it was asked before) without waiting for it: the file is decoded
+	//in a worker thread and UploadPending sends it to VRAM, until then it shows a 1x1 placeholder (a flat normal, also a neutral color)
+	static Texture* Get(const char* filename, bool mipmaps = true);
+	static std::map<std::string, Texture*> s_Textures;
+
+	//uploads the textures already decoded, stopping after max_ms (at least one is uploaded per call). Call it from the GL thread every frame
+	static void UploadPending(double max_ms = TEXTURE_UPLOAD_BUDGET_MS);
+	static int NumPending(); //textures of Get not uploaded yet
+
 protected:
-	TGAInfo* loadTGA(const char* filename);
+	bool mipmaps;
+	int bytes_per_pixel; //3 (BGR) or 4 (BGRA), once it has its own storage
+	TGAInfo* decoded; //set by the loader thread, NULL if the file could not be read
+
+	static TGAInfo* loadTGA(const char* filename);
+	void upload(TGAInfo* tgainfo, bool mipmaps);
+
+	static GLuint GetPlaceholder();
+	static void LoaderThread();
 };
 
 #endif
\ No newline at end of file